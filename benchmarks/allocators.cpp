@@ -0,0 +1,105 @@
+// Compares the allocators which can be given to evaluation traversals.
+
+#include "entries.hpp"
+#include "harness.hpp"
+
+#include <cstdio>
+#include <memory_resource>
+
+// the tree of the tests, where `subtree` replaces the file "tree-algorithms.hpp"
+Entries test_tree(Entries const& subtree)
+{
+    // clang-format off
+    Entries entries {
+        Directory{"TreeAlgorithms", 3},
+            File{"README.md", 100},
+            Directory{"src", 2},
+                Directory{"jv", 1},
+    };
+    entries.insert(entries.end(), subtree.begin(), subtree.end());
+    entries.insert(entries.end(), {
+                File{"main.cpp", 400},
+            File{"LICENSE", 200},
+    });
+    // clang-format on
+    return entries;
+}
+
+// scaling up the test tree: `width` copies of the test tree, nested `depth` times
+Entries scaled_tree(int width, int depth)
+{
+    Entries tree{File{"tree-algorithms.hpp", 800}};
+    for (int i = 0; i < depth; ++i) {
+        Entries copy = test_tree(tree);
+        tree.assign({Directory{"copies", width}});
+        for (int j = 0; j < width; ++j)
+            tree.insert(tree.end(), copy.begin(), copy.end());
+    }
+    return tree;
+}
+
+// prints the time per node of evaluating `tree` with `evaluate(root)`
+template <typename Evaluate>
+void run(char const* name, Entries const& tree, Evaluate evaluate)
+{
+    bench::run(name, tree.size(), [&] { bench::doNotOptimize(evaluate(tree.begin())); });
+}
+
+template <template <typename...> class Evaluation>
+void run_all(char const* name, Entries const& tree)
+{
+    std::printf("%s, %zu nodes, depth %zu\n", name, tree.size(),
+                EntryTraits::getDepth(tree.begin()));
+
+    run("std::allocator", tree, [](auto root) { return Evaluation<>::run(root); });
+
+    run("pmr::monotonic_buffer_resource", tree, [](auto root) {
+        unsigned char buffer[64 * sizeof(int)];
+        std::pmr::monotonic_buffer_resource resource(buffer, sizeof(buffer));
+        return Evaluation<>::run(root, std::pmr::polymorphic_allocator<int>(&resource));
+    });
+
+    jv::StackArena arena;
+    run("jv::StackArena", tree, [&](auto root) {
+        arena.reset();
+        return Evaluation<>::run(root, jv::ArenaAllocator<int>(arena));
+    });
+
+    run("jv::InlineArena<64 * sizeof(int)>", tree, [](auto root) {
+        jv::InlineArena<64 * sizeof(int)> inline_arena;
+        return Evaluation<>::run(root, jv::ArenaAllocator<int>(inline_arena));
+    });
+}
+
+template <typename...>
+struct Recursive {
+    template <typename... Allocator>
+    static int run(EntryTraits::iterator root, Allocator... alloc)
+    {
+        return EntryTraits::evaluationTraversal<int>(root, sum_sizes, alloc...).first;
+    }
+};
+
+template <typename...>
+struct Iterative {
+    template <typename... Allocator>
+    static int run(EntryTraits::iterator root, Allocator... alloc)
+    {
+        return EntryTraits::iterativeEvaluationTraversal<int>(root, sum_sizes, alloc...).first;
+    }
+};
+
+int main()
+{
+    Entries small = scaled_tree(1, 1);
+    Entries wide = scaled_tree(1000, 1);
+    Entries deep = scaled_tree(2, 10);
+
+    run_all<Recursive>("evaluationTraversal, test tree", small);
+    run_all<Recursive>("evaluationTraversal, wide tree", wide);
+    run_all<Recursive>("evaluationTraversal, deep tree", deep);
+    run_all<Iterative>("iterativeEvaluationTraversal, test tree", small);
+    run_all<Iterative>("iterativeEvaluationTraversal, wide tree", wide);
+    run_all<Iterative>("iterativeEvaluationTraversal, deep tree", deep);
+    return 0;
+}
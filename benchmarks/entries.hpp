@@ -0,0 +1,68 @@
+// Same nodes as in tests/tree-algorithms.cpp, a file system hierarchy stored as std::variant.
+
+#ifndef JVERNAY_BENCHMARKS_ENTRIES_HPP
+#define JVERNAY_BENCHMARKS_ENTRIES_HPP
+
+#include <jv/tree-algorithms.hpp>
+
+#include <cstdint>
+#include <numeric>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+struct File {
+    std::string_view name;
+    int size;
+};
+
+struct Directory {
+    std::string_view name;
+    int nb_children;
+};
+
+using Entry = std::variant<File, Directory>;
+using Entries = std::vector<Entry>;
+
+struct EntryTraits : jv::NodeTraits<Entries::const_iterator, EntryTraits> {
+    static auto getChildrenCount(iterator it) noexcept -> std::size_t
+    {
+        if (auto dir = std::get_if<Directory>(&*it))
+            return dir->nb_children;
+        else
+            return 0;
+    }
+};
+
+// same traits, counting the work of the traversals
+struct CountedEntryTraits : jv::NodeTraits<Entries::const_iterator, CountedEntryTraits> {
+    using Instrumentation = jv::CountingInstrumentation<CountedEntryTraits>;
+
+    static std::size_t getChildrenCount(iterator it) noexcept
+    {
+        return EntryTraits::getChildrenCount(it);
+    }
+};
+
+inline int sum_sizes(EntryTraits::iterator node, int* it, int* end)
+{
+    if (auto file = std::get_if<File>(&*node))
+        return file->size;
+    return std::accumulate(it, end, 0);
+}
+
+// leaves become files, other nodes become directories
+inline Entries to_entries(std::vector<std::uint32_t> const& arities)
+{
+    Entries entries;
+    entries.reserve(arities.size());
+    for (std::size_t i = 0; i < arities.size(); ++i) {
+        if (arities[i] == 0)
+            entries.push_back(File{"file", static_cast<int>(i % 1000)});
+        else
+            entries.push_back(Directory{"dir", static_cast<int>(arities[i])});
+    }
+    return entries;
+}
+
+#endif
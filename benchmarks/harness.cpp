@@ -0,0 +1,100 @@
+#include "harness.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+
+namespace {
+std::atomic<std::size_t> allocated_bytes{0};
+}
+
+void* operator new(std::size_t size)
+{
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace bench {
+
+std::size_t allocatedBytes() noexcept { return allocated_bytes.load(std::memory_order_relaxed); }
+
+std::string_view shapeName(Shape shape) noexcept
+{
+    switch (shape) {
+    case Shape::Balanced: return "balanced";
+    case Shape::Wide: return "wide";
+    case Shape::DeepChain: return "deep chain";
+    case Shape::Random: return "random";
+    default: return "?";
+    }
+}
+
+std::vector<std::uint32_t> generate(Shape shape, std::size_t nb_nodes, std::uint32_t max_children)
+{
+    std::vector<std::uint32_t> arities;
+    arities.reserve(nb_nodes);
+    switch (shape) {
+    case Shape::Balanced: {
+        // finding the depth to have at most nb_nodes nodes
+        std::size_t depth = 0;
+        for (std::size_t size = 1, level = 1; size + level * max_children <= nb_nodes; ++depth) {
+            level *= max_children;
+            size += level;
+        }
+        std::vector<std::size_t> remaining; // children to generate for each ancestor
+        while (true) {
+            std::uint32_t nb_children = remaining.size() < depth ? max_children : 0;
+            arities.push_back(nb_children);
+            remaining.push_back(nb_children);
+            while (remaining.back() == 0) {
+                remaining.pop_back();
+                if (remaining.empty())
+                    return arities;
+            }
+            --remaining.back();
+        }
+    }
+    case Shape::Wide:
+        arities.assign(nb_nodes, 0);
+        arities[0] = static_cast<std::uint32_t>(nb_nodes - 1);
+        return arities;
+    case Shape::DeepChain:
+        for (std::size_t i = 0; i + 3 <= nb_nodes; i += 2) {
+            arities.push_back(2);
+            arities.push_back(0);
+        }
+        arities.push_back(0);
+        return arities;
+    case Shape::Random: {
+        std::mt19937 random(42);
+        std::uniform_int_distribution<std::uint32_t> distribution(0, max_children);
+        std::size_t pending = 1; // nodes which must still be generated
+        for (std::size_t i = 0; i < nb_nodes && pending > 0; ++i) {
+            std::size_t left = nb_nodes - i - 1; // nodes that can still be generated
+            std::size_t nb_children = distribution(random);
+            nb_children = std::min(nb_children, left - (pending - 1));
+            if (pending == 1 && nb_children == 0 && left > 0)
+                nb_children = 1; // the tree must not end before nb_nodes
+            arities.push_back(static_cast<std::uint32_t>(nb_children));
+            pending = pending - 1 + nb_children;
+        }
+        return arities;
+    }
+    default: return arities;
+    }
+}
+
+std::size_t maxNodes(int argc, char** argv)
+{
+    return argc > 1 ? std::stoull(argv[1]) : 1'000'000;
+}
+
+} // namespace bench
@@ -0,0 +1,70 @@
+// Minimal benchmark harness: timing, allocation counting and synthetic tree generators.
+
+#ifndef JVERNAY_BENCHMARKS_HARNESS_HPP
+#define JVERNAY_BENCHMARKS_HARNESS_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+namespace bench {
+
+/// Number of bytes allocated with operator new since the start of the program.
+std::size_t allocatedBytes() noexcept;
+
+/// Prevents the compiler from optimizing away the computation of `value`.
+template <typename T>
+void doNotOptimize(T const& value)
+{
+#if defined(__GNUC__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T sink;
+    sink = value;
+#endif
+}
+
+/// Runs `func()` repeatedly for at least 0.2 seconds, then prints the time per node and the
+/// number of bytes allocated per run.
+template <typename Func>
+void run(std::string_view name, std::size_t nb_nodes, Func&& func)
+{
+    using clock = std::chrono::steady_clock;
+    func(); // warm-up
+
+    std::size_t nb_runs = 0;
+    std::size_t bytes = allocatedBytes();
+    auto start = clock::now();
+    std::chrono::duration<double, std::nano> elapsed{};
+    do {
+        func();
+        ++nb_runs;
+        elapsed = clock::now() - start;
+    } while (elapsed < std::chrono::milliseconds(200));
+    bytes = allocatedBytes() - bytes;
+
+    std::printf("  %-44.*s %8.2f ns/node %12zu B/run\n", static_cast<int>(name.size()),
+                name.data(), elapsed.count() / (nb_runs * nb_nodes), bytes / nb_runs);
+}
+
+/// Synthetic tree shapes, generated as the children count of each node in preorder.
+enum class Shape { Balanced, Wide, DeepChain, Random };
+
+std::string_view shapeName(Shape shape) noexcept;
+
+/// Generates a tree of about `nb_nodes` nodes, whose nodes have at most `max_children` children.
+/// + Balanced: all the internal nodes have `max_children` children
+/// + Wide: the root has all the other nodes as children (ignores `max_children`)
+/// + DeepChain: right-leaning chain of binary nodes, whose left child is a leaf
+/// + Random: each node has a random number of children in [0, max_children]
+std::vector<std::uint32_t> generate(Shape shape, std::size_t nb_nodes, std::uint32_t max_children);
+
+/// Returns the maximum number of nodes given in the command line, 10^6 by default.
+std::size_t maxNodes(int argc, char** argv);
+
+} // namespace bench
+
+#endif
@@ -0,0 +1,56 @@
+// Benchmarks the parsers of the polish-notation example: vector of virtual nodes, and flat tree.
+// Usage: bench-parsing [max_nodes], by default expressions have up to 10^6 nodes.
+
+#include "../examples/polish-notation.hpp"
+#include "harness.hpp"
+
+#include <cstdio>
+#include <string>
+
+using bench::Shape;
+
+// leaves become numbers, unary nodes square roots, and binary nodes additions or powers
+std::string to_expression(std::vector<std::uint32_t> const& arities)
+{
+    std::string expression;
+    for (std::size_t i = 0; i < arities.size(); ++i) {
+        if (arities[i] == 0)
+            expression += "2.5 ";
+        else if (arities[i] == 1)
+            expression += "sqrt ";
+        else
+            expression += i % 2 ? "+ " : "pow ";
+    }
+    return expression;
+}
+
+void bench_parsing(Shape shape, std::size_t nb_nodes)
+{
+    std::string expression = to_expression(bench::generate(shape, nb_nodes, 2));
+    MathTree tree = parse_expression(expression);
+    std::printf("polish notation, %s tree, %zu nodes\n", bench::shapeName(shape).data(),
+                tree.size());
+
+    bench::run("parse_expression (virtual nodes)", tree.size(),
+               [&] { bench::doNotOptimize(parse_expression(expression).size()); });
+    FlatMathTree flat_tree;
+    bench::run("parse_expression (FlatMathTree, reused)", tree.size(), [&] {
+        parse_expression(expression, flat_tree);
+        bench::doNotOptimize(flat_tree.size());
+    });
+    bench::run("parse then evaluate (virtual nodes)", tree.size(),
+               [&] { bench::doNotOptimize(evaluate(expression)); });
+    bench::run("parse then evaluate (FlatMathTree, reused)", tree.size(), [&] {
+        parse_expression(expression, flat_tree);
+        bench::doNotOptimize(evaluate(flat_tree));
+    });
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t max_nodes = bench::maxNodes(argc, argv);
+    for (std::size_t nb_nodes = 1000; nb_nodes <= max_nodes; nb_nodes *= 10)
+        for (Shape shape : {Shape::Balanced, Shape::Random})
+            bench_parsing(shape, nb_nodes);
+    return 0;
+}
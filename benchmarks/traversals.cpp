@@ -0,0 +1,527 @@
+// Benchmarks the traversals on synthetic trees, with the std::variant nodes of the tests
+// and the virtual and std::variant nodes of the polish-notation example.
+// Usage: bench-traversals [max_nodes], by default trees have up to 10^6 nodes.
+
+#include "../examples/polish-notation.hpp"
+#include "entries.hpp"
+#include "harness.hpp"
+
+#include <cstdio>
+#include <iterator>
+#include <random>
+#include <string>
+
+using bench::Shape;
+
+// the recursive traversals are not run on deeper trees, to avoid stack overflows
+constexpr std::size_t max_recursive_depth = 10'000;
+
+void bench_entries(Shape shape, std::size_t nb_nodes)
+{
+    Entries tree = to_entries(bench::generate(shape, nb_nodes, 4));
+    auto root = tree.cbegin();
+    std::size_t depth = EntryTraits::getDepth(root);
+    std::printf("entries, %s tree, %zu nodes, depth %zu\n", bench::shapeName(shape).data(),
+                tree.size(), depth);
+    bool recursive = depth <= max_recursive_depth;
+
+    if (recursive)
+        bench::run("recursiveTraversal", tree.size(), [&] {
+            std::size_t count = 0;
+            EntryTraits::recursiveTraversal(root, [&](auto node, auto& self) {
+                ++count;
+                return EntryTraits::recursiveTraversal(node, self);
+            });
+            bench::doNotOptimize(count);
+        });
+    bench::run("iterativeTraversal", tree.size(), [&] {
+        std::size_t count = 0;
+        EntryTraits::iterativeTraversal(
+            root, [&](auto) { ++count; }, [](auto) {});
+        bench::doNotOptimize(count);
+    });
+    bench::run("getNextSibling (children of root)", tree.size(), [&] {
+        std::size_t count = 0;
+        auto end = tree.cend();
+        for (auto child = root + 1; child != end; child = EntryTraits::getNextSibling(child))
+            ++count;
+        bench::doNotOptimize(count);
+    });
+    if (recursive)
+        bench::run("ancestorsTraversal", tree.size(), [&] {
+            std::size_t total_depth = 0;
+            EntryTraits::ancestorsTraversal(root,
+                                            [&](auto begin, auto end) { total_depth += end - begin; });
+            bench::doNotOptimize(total_depth);
+        });
+    bench::run("iterativeAncestorsTraversal", tree.size(), [&] {
+        std::size_t total_depth = 0;
+        EntryTraits::iterativeAncestorsTraversal(
+            root, [&](auto begin, auto end) { total_depth += end - begin; });
+        bench::doNotOptimize(total_depth);
+    });
+    // accumulated path cost: the number of children of the ancestors,
+    // which is quadratic in the depth when recomputed from the ancestors
+    auto cost = [](auto node) {
+        auto dir = std::get_if<Directory>(&*node);
+        return dir ? dir->nb_children : 0;
+    };
+    if (recursive)
+        bench::run("iterativeAncestorsTraversal (path costs)", tree.size(), [&] {
+            int total = 0;
+            EntryTraits::iterativeAncestorsTraversal(root, [&](auto begin, auto end) {
+                for (; begin != end; ++begin)
+                    total += cost(*begin);
+            });
+            bench::doNotOptimize(total);
+        });
+    bench::run("propagationTraversal (path costs)", tree.size(), [&] {
+        int total = 0;
+        EntryTraits::propagationTraversal(root, 0, [&](auto node, int parent_cost) {
+            total += parent_cost + cost(node);
+            return parent_cost + cost(node);
+        });
+        bench::doNotOptimize(total);
+    });
+    if (recursive)
+        bench::run("evaluationTraversal", tree.size(), [&] {
+            bench::doNotOptimize(EntryTraits::evaluationTraversal<int>(root, sum_sizes).first);
+        });
+    bench::run("iterativeEvaluationTraversal", tree.size(), [&] {
+        bench::doNotOptimize(EntryTraits::iterativeEvaluationTraversal<int>(root, sum_sizes).first);
+    });
+    bench::run("resumableEvaluationTraversal (slices of 256)", tree.size(), [&] {
+        auto evaluation = EntryTraits::resumableEvaluationTraversal<int>(root, sum_sizes);
+        while (!evaluation.resume(256))
+            ;
+        bench::doNotOptimize(evaluation.value());
+    });
+    bench::run("iterativeEvaluationTraversal (counted)", tree.size(), [&] {
+        bench::doNotOptimize(
+            CountedEntryTraits::iterativeEvaluationTraversal<int>(root, sum_sizes).first);
+    });
+    auto program = EntryTraits::compile(root).first;
+    std::vector<int> stack(program.stackSize());
+    bench::run("PostfixProgram::evaluate", tree.size(), [&] {
+        bench::doNotOptimize(program.evaluate<int>(sum_sizes, stack.data()));
+    });
+
+    // heavy values: histogram of the file sizes modulo 8 in each subtree
+    using Histogram = std::vector<int>;
+    auto add_histograms = [](auto node, Histogram const* it, Histogram const* end,
+                             Histogram& result) {
+        result.assign(8, 0);
+        if (auto file = std::get_if<File>(&*node))
+            ++result[file->size % 8];
+        for (; it != end; ++it)
+            for (std::size_t i = 0; i != 8; ++i)
+                result[i] += (*it)[i];
+    };
+    bench::run("iterativeEvaluationTraversal (histograms)", tree.size(), [&] {
+        auto histogram = EntryTraits::iterativeEvaluationTraversal<Histogram>(
+            root, [&](auto node, Histogram* it, Histogram* end) {
+                Histogram result;
+                add_histograms(node, it, end, result);
+                return result;
+            });
+        bench::doNotOptimize(histogram.first.data());
+    });
+    EntryTraits::Workspace<Histogram> workspace;
+    bench::run("inplaceEvaluationTraversal (histograms)", tree.size(), [&] {
+        auto histogram =
+            EntryTraits::inplaceEvaluationTraversal<Histogram>(root, add_histograms, workspace);
+        bench::doNotOptimize(histogram.first.data());
+    });
+}
+
+// structure-only passes, on std::variant nodes and on the arity column of a FlatTree
+void bench_structure(Shape shape, std::size_t nb_nodes)
+{
+    auto arities = bench::generate(shape, nb_nodes, 4);
+    Entries entries = to_entries(arities);
+    jv::FlatTree<int, std::uint8_t> flat;
+    flat.reserve(arities.size());
+    for (auto nb_children : arities)
+        flat.push_back(0, nb_children);
+    std::printf("structure only, %s tree, %zu nodes\n", bench::shapeName(shape).data(),
+                arities.size());
+
+    auto bench_traits = [&](auto traits, std::string const& name, auto begin, auto end) {
+        using Traits = decltype(traits);
+        bench::run(name + "getNextSibling (children of root)", arities.size(), [&] {
+            std::size_t count = 0;
+            for (auto child = begin + 1; child != end; child = Traits::getNextSibling(child))
+                ++count;
+            bench::doNotOptimize(count);
+        });
+        bench::run(name + "getDepth", arities.size(),
+                   [&] { bench::doNotOptimize(Traits::getDepth(begin)); });
+        bench::run(name + "SubtreeIndex", arities.size(), [&] {
+            jv::SubtreeIndex<Traits> index(begin, end);
+            bench::doNotOptimize(index.sizes());
+        });
+    };
+    bench_traits(EntryTraits{}, "entries, ", entries.cbegin(), entries.cend());
+    bench_traits(decltype(flat)::traits{}, "FlatTree, ", flat.begin(), flat.end());
+    // the children counts are at most 4, which fit in 4-bit codes
+    jv::CompactFlatTree<int> compact2(flat.view());
+    jv::CompactFlatTree<int, 4> compact(flat.view());
+    std::printf("  CompactFlatTree: %.2f bits per node with 2-bit codes, %.2f with 4-bit codes\n",
+                8.0 * compact2.arities().memoryUsage() / flat.size(),
+                8.0 * compact.arities().memoryUsage() / flat.size());
+    bench_traits(decltype(compact2)::traits{}, "CompactFlatTree<2>, ", compact2.begin(),
+                 compact2.end());
+    bench_traits(decltype(compact)::traits{}, "CompactFlatTree<4>, ", compact.begin(),
+                 compact.end());
+    auto count_leaves = [](auto, int* it, int* end) {
+        return it == end ? 1 : std::accumulate(it, end, 0);
+    };
+    bench::run("FlatTree, iterativeEvaluationTraversal", flat.size(), [&] {
+        using Traits = decltype(flat)::traits;
+        bench::doNotOptimize(
+            Traits::iterativeEvaluationTraversal<int>(flat.begin(), count_leaves).first);
+    });
+    bench::run("CompactFlatTree<4>, iterativeEvaluationTraversal", compact.size(), [&] {
+        using Traits = decltype(compact)::traits;
+        bench::doNotOptimize(
+            Traits::iterativeEvaluationTraversal<int>(compact.begin(), count_leaves).first);
+    });
+
+    using FlatTraits = decltype(flat)::traits;
+    bench::run("FlatTree, AncestorIndex", flat.size(), [&] {
+        jv::AncestorIndex<FlatTraits> index(flat.begin(), flat.end());
+        bench::doNotOptimize(index.size());
+    });
+    jv::AncestorIndex<FlatTraits> ancestors(flat.begin(), flat.end());
+    std::mt19937 random(42);
+    std::vector<decltype(flat)::iterator> queries;
+    for (int i = 0; i < 20000; ++i)
+        queries.push_back(flat.begin() + random() % flat.size());
+    std::size_t nb_pairs = queries.size() / 2;
+    bench::run("AncestorIndex, LCA by climbing parents (per query)", nb_pairs, [&] {
+        std::size_t sum = 0;
+        for (std::size_t i = 0; i != nb_pairs; ++i) {
+            auto a = queries[2 * i], b = queries[2 * i + 1];
+            while (ancestors.getDepth(a) > ancestors.getDepth(b))
+                a = ancestors.getParent(a);
+            while (ancestors.getDepth(b) > ancestors.getDepth(a))
+                b = ancestors.getParent(b);
+            while (a != b) {
+                a = ancestors.getParent(a);
+                b = ancestors.getParent(b);
+            }
+            sum += a - flat.begin();
+        }
+        bench::doNotOptimize(sum);
+    });
+    bench::run("AncestorIndex, getLowestCommonAncestor (per query)", nb_pairs, [&] {
+        std::size_t sum = 0;
+        for (std::size_t i = 0; i != nb_pairs; ++i)
+            sum += ancestors.getLowestCommonAncestor(queries[2 * i], queries[2 * i + 1]) -
+                   flat.begin();
+        bench::doNotOptimize(sum);
+    });
+    bench::run("AncestorIndex, getAncestor at half depth (per query)", queries.size(), [&] {
+        std::size_t sum = 0;
+        for (auto node : queries)
+            sum += ancestors.getAncestor(node, ancestors.getDepth(node) / 2) - flat.begin();
+        bench::doNotOptimize(sum);
+    });
+
+    jv::FlatTree<int, std::uint8_t> copy;
+    using Transform = jv::Transform<int, std::uint8_t>;
+    bench::run("FlatTree, copy by push_back", flat.size(), [&] {
+        copy.clear();
+        for (std::size_t i = 0; i != flat.size(); ++i)
+            copy.push_back(flat.payload(i), flat.arities()[i]);
+        bench::doNotOptimize(copy.size());
+    });
+    bench::run("FlatTree, transformTraversal (copy)", flat.size(), [&] {
+        copy.clear();
+        decltype(flat)::traits::transformTraversal(
+            flat.begin(), [](auto node) { return Transform::keep(*node); }, copy);
+        bench::doNotOptimize(copy.size());
+    });
+    bench::run("FlatTree, transformTraversal (removing leaves)", flat.size(), [&] {
+        copy.clear();
+        decltype(flat)::traits::transformTraversal(
+            flat.begin(),
+            [](auto node) {
+                return node.arity() == 0 ? Transform::remove() : Transform::keep(*node);
+            },
+            copy);
+        bench::doNotOptimize(copy.size());
+    });
+
+    std::vector<std::uint32_t> depths(flat.size()), parents(flat.size());
+    bench::run("FlatTree, depths and parents by iterativeAncestorsTraversal", flat.size(), [&] {
+        auto depth = depths.begin();
+        auto parent = parents.begin();
+        using Traits = decltype(flat)::traits;
+        Traits::iterativeAncestorsTraversal(flat.begin(), [&](auto begin, auto end) {
+            *depth++ = static_cast<std::uint32_t>(end - begin - 1);
+            *parent++ = end - begin == 1 ? 0 : static_cast<std::uint32_t>(end[-2] - flat.begin());
+        });
+        bench::doNotOptimize(depths.data());
+    });
+    bench::run("FlatTree, fillDepthsAndParents", flat.size(), [&] {
+        jv::fillDepthsAndParents(flat.arities().data(), flat.size(), depths.data(), parents.data());
+        bench::doNotOptimize(depths.data());
+    });
+    bench::run("FlatTree, parallelFillDepthsAndParents", flat.size(), [&] {
+        jv::parallelFillDepthsAndParents(flat.arities().data(), flat.size(), depths.data(),
+                                         parents.data());
+        bench::doNotOptimize(depths.data());
+    });
+}
+
+// leaves become numbers, unary nodes square roots, and binary nodes additions
+MathTree to_math_tree(std::vector<std::uint32_t> const& arities)
+{
+    MathTree tree;
+    tree.reserve(arities.size());
+    for (auto nb_children : arities) {
+        if (nb_children == 0)
+            tree.push_back(std::make_unique<Number>(2.0));
+        else
+            tree.push_back(std::make_unique<Operation>(nb_children == 1 ? "sqrt" : "+"));
+    }
+    return tree;
+}
+
+// same as to_math_tree, with the nodes stored inline
+VariantMathTree to_variant_tree(std::vector<std::uint32_t> const& arities)
+{
+    VariantMathTree tree;
+    tree.reserve(arities.size());
+    for (auto nb_children : arities) {
+        if (nb_children == 0)
+            tree.push_back(variant_nodes::Number{2.0});
+        else if (nb_children == 1)
+            tree.push_back(variant_nodes::Sqrt{});
+        else
+            tree.push_back(variant_nodes::Add{});
+    }
+    return tree;
+}
+
+void bench_math_tree(Shape shape, std::size_t nb_nodes)
+{
+    MathTree tree = to_math_tree(bench::generate(shape, nb_nodes, 2));
+    auto root = tree.cbegin();
+    std::size_t depth = NodeTraits::getDepth(root);
+    std::printf("polish notation, %s tree, %zu nodes, depth %zu\n", bench::shapeName(shape).data(),
+                tree.size(), depth);
+
+    auto get_value = [](auto node, double* begin, double* end) {
+        return (*node)->getValue(begin, end);
+    };
+    if (depth <= max_recursive_depth)
+        bench::run("evaluationTraversal", tree.size(), [&] {
+            bench::doNotOptimize(NodeTraits::evaluationTraversal<double>(root, get_value).first);
+        });
+    bench::run("iterativeEvaluationTraversal", tree.size(), [&] {
+        bench::doNotOptimize(
+            NodeTraits::iterativeEvaluationTraversal<double>(root, get_value).first);
+    });
+    if (depth <= 64)
+        bench::run("boundedEvaluationTraversal<64>", tree.size(), [&] {
+            bench::doNotOptimize(
+                NodeTraits::boundedEvaluationTraversal<double, 64>(root, get_value).first);
+        });
+    auto program = compile(tree);
+    std::vector<double> stack(program.stackSize());
+    bench::run("PostfixProgram::evaluate", tree.size(),
+               [&] { bench::doNotOptimize(evaluate(program, stack.data())); });
+
+    // the same tree with std::variant nodes stored inline, instead of virtual nodes
+    VariantMathTree variant_tree = to_variant_tree(bench::generate(shape, nb_nodes, 2));
+    auto variant_root = variant_tree.cbegin();
+    auto get_variant_value = [](auto node, double* begin, double*) {
+        return ::get_value(*node, begin);
+    };
+    if (depth <= max_recursive_depth)
+        bench::run("variant, evaluationTraversal", tree.size(), [&] {
+            bench::doNotOptimize(
+                VariantNodeTraits::evaluationTraversal<double>(variant_root, get_variant_value)
+                    .first);
+        });
+    bench::run("variant, iterativeEvaluationTraversal", tree.size(), [&] {
+        bench::doNotOptimize(
+            VariantNodeTraits::iterativeEvaluationTraversal<double>(variant_root, get_variant_value)
+                .first);
+    });
+    if (depth <= 64)
+        bench::run("variant, boundedEvaluationTraversal<64>", tree.size(), [&] {
+            bench::doNotOptimize(VariantNodeTraits::boundedEvaluationTraversal<double, 64>(
+                                     variant_root, get_variant_value)
+                                     .first);
+        });
+
+    // all the leaves are equal, so subtrees of the same shape are equal
+    auto node_hash = [](auto node) {
+        auto number = std::get_if<variant_nodes::Number>(&*node);
+        return jv::hashCombine(node->index(), number ? std::hash<double>{}(number->value) : 0);
+    };
+    auto node_equal = [](auto lhs, auto rhs) {
+        auto number = std::get_if<variant_nodes::Number>(&*lhs);
+        return lhs->index() == rhs->index() &&
+               (!number || number->value == std::get<variant_nodes::Number>(*rhs).value);
+    };
+    bench::run("variant, hashTraversal", tree.size(), [&] {
+        bench::doNotOptimize(VariantNodeTraits::hashTraversal(variant_root, node_hash).first);
+    });
+    bench::run("variant, SubtreeDag construction", tree.size(), [&] {
+        jv::SubtreeDag<VariantNodeTraits> dag(variant_tree.cbegin(), variant_tree.cend(),
+                                              node_hash, node_equal);
+        bench::doNotOptimize(dag.size());
+    });
+    jv::SubtreeDag<VariantNodeTraits> dag(variant_tree.cbegin(), variant_tree.cend(), node_hash,
+                                          node_equal);
+    bench::run("variant, SubtreeDag::evaluate (" + std::to_string(dag.size()) + " subtrees)",
+               tree.size(), [&] {
+                   bench::doNotOptimize(dag.evaluate<double>(get_variant_value).back());
+               });
+}
+
+// many small trees back to back, evaluated one call per tree or as a forest
+void bench_forest(std::size_t nb_nodes)
+{
+    std::vector<std::uint32_t> arities;
+    while (arities.size() < nb_nodes) {
+        auto tree = bench::generate(Shape::Random, 20, 3);
+        arities.insert(arities.end(), tree.begin(), tree.end());
+    }
+    Entries forest = to_entries(arities);
+    std::vector<int> values;
+    values.reserve(forest.size());
+    std::printf("forest of small random trees, %zu nodes\n", forest.size());
+
+    bench::run("evaluationTraversal per tree", forest.size(), [&] {
+        values.clear();
+        for (auto root = forest.cbegin(); root != forest.cend();) {
+            auto [value, next] = EntryTraits::evaluationTraversal<int>(root, sum_sizes);
+            values.push_back(value);
+            root = next;
+        }
+        bench::doNotOptimize(values.data());
+    });
+    bench::run("forestEvaluationTraversal", forest.size(), [&] {
+        values.clear();
+        EntryTraits::forestEvaluationTraversal<int>(forest.cbegin(), forest.cend(), sum_sizes,
+                                                    std::back_inserter(values));
+        bench::doNotOptimize(values.data());
+    });
+    bench::run("parallelForestEvaluationTraversal", forest.size(), [&] {
+        values.clear();
+        EntryTraits::parallelForestEvaluationTraversal<int>(forest.cbegin(), forest.cend(),
+                                                            sum_sizes, std::back_inserter(values));
+        bench::doNotOptimize(values.data());
+    });
+}
+
+// sums the payloads of the nodes at most `depth` levels below the given node
+template <class Index, class Iterator>
+int sum_levels(Index const& index, Iterator node, int depth)
+{
+    int sum = *node;
+    if (depth != 0) {
+        index.forEachChild(node,
+                           [&](Iterator child) { sum += sum_levels(index, child, depth - 1); });
+    }
+    return sum;
+}
+
+int sum_levels(jv::BlockedLayout<int, std::uint8_t> const& layout, std::size_t node, int depth)
+{
+    int sum = layout.payload(node);
+    if (depth != 0) {
+        std::size_t child = layout.getFirstChild(node);
+        for (std::size_t end = child + layout.getChildrenCount(node); child != end; ++child)
+            sum += sum_levels(layout, child, depth - 1);
+    }
+    return sum;
+}
+
+void bench_layout(Shape shape, std::size_t nb_nodes)
+{
+    auto arities = bench::generate(shape, nb_nodes, 4);
+    jv::FlatTree<int, std::uint8_t> flat;
+    flat.reserve(arities.size());
+    for (auto nb_children : arities)
+        flat.push_back(1, nb_children);
+    using Traits = decltype(flat)::traits;
+    jv::SubtreeIndex<Traits> index(flat.begin(), flat.end());
+    jv::BlockedLayout<int, std::uint8_t> layout(flat.view());
+    std::printf("random subtree queries, %s tree, %zu nodes\n", bench::shapeName(shape).data(),
+                flat.size());
+
+    // the same random nodes are queried in both layouts
+    constexpr int query_depth = 3;
+    constexpr std::size_t max_subtree_size = 4096;
+    std::mt19937 random(42);
+    std::vector<std::size_t> queries, positions;
+    std::size_t nb_visited = 0, nb_evaluated = 0;
+    for (int i = 0; i < 1000; ++i) {
+        std::size_t query = random() % flat.size();
+        queries.push_back(query);
+        positions.push_back(layout.position(query));
+        nb_visited += sum_levels(index, flat.begin() + query, query_depth);
+        std::size_t size = index.getSubtreeSize(flat.begin() + query);
+        nb_evaluated += size <= max_subtree_size ? size : 0;
+    }
+
+    bench::run("preorder, top levels of random subtrees", nb_visited, [&] {
+        int sum = 0;
+        for (std::size_t query : queries)
+            sum += sum_levels(index, flat.begin() + query, query_depth);
+        bench::doNotOptimize(sum);
+    });
+    bench::run("BlockedLayout, top levels of random subtrees", nb_visited, [&] {
+        int sum = 0;
+        for (std::size_t position : positions)
+            sum += sum_levels(layout, position, query_depth);
+        bench::doNotOptimize(sum);
+    });
+
+    auto preorder_sum = [](auto node, int* it, int* end) {
+        return std::accumulate(it, end, *node);
+    };
+    auto blocked_sum = [&](std::size_t node, int* it, int* end) {
+        return std::accumulate(it, end, layout.payload(node));
+    };
+    bench::run("preorder, evaluation of random subtrees", nb_evaluated, [&] {
+        int sum = 0;
+        for (std::size_t query : queries) {
+            auto root = flat.begin() + query;
+            if (index.getSubtreeSize(root) <= max_subtree_size)
+                sum += Traits::iterativeEvaluationTraversal<int>(root, preorder_sum).first;
+        }
+        bench::doNotOptimize(sum);
+    });
+    bench::run("BlockedLayout, evaluation of random subtrees", nb_evaluated, [&] {
+        int sum = 0;
+        for (std::size_t i = 0; i < queries.size(); ++i) {
+            if (index.getSubtreeSize(flat.begin() + queries[i]) <= max_subtree_size)
+                sum += layout.evaluate<int>(positions[i], blocked_sum);
+        }
+        bench::doNotOptimize(sum);
+    });
+}
+
+int main(int argc, char** argv)
+{
+    std::size_t max_nodes = bench::maxNodes(argc, argv);
+    for (std::size_t nb_nodes = 1000; nb_nodes <= max_nodes; nb_nodes *= 10) {
+        for (Shape shape : {Shape::Balanced, Shape::Wide, Shape::DeepChain, Shape::Random})
+            bench_entries(shape, nb_nodes);
+        for (Shape shape : {Shape::Balanced, Shape::DeepChain, Shape::Random})
+            bench_math_tree(shape, nb_nodes);
+        for (Shape shape : {Shape::Balanced, Shape::Random})
+            bench_structure(shape, nb_nodes);
+        for (Shape shape : {Shape::Balanced, Shape::Random})
+            bench_layout(shape, nb_nodes);
+        bench_forest(nb_nodes);
+    }
+    return 0;
+}
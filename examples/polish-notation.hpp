@@ -0,0 +1,388 @@
+// Evaluation of mathematical expressions in polish notation, such as "- x 3 5 / 8 2".
+// Used by polish-notation.cpp and by the benchmarks.
+
+#ifndef JVERNAY_EXAMPLES_POLISH_NOTATION_HPP
+#define JVERNAY_EXAMPLES_POLISH_NOTATION_HPP
+
+#include <jv/tree-algorithms.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <variant>
+
+inline std::vector<std::string_view> split_tokens(std::string_view str)
+{
+    std::vector<std::string_view> result;
+    while (true) {
+        // removing spaces at beginning of str
+        str.remove_prefix(std::min(str.find_first_not_of(" \r\t\n"), str.size()));
+        if (str.empty())
+            // no tokens left
+            return result;
+        // getting index of the token end
+        auto token_end = std::min(str.find_first_of(" \r\t\n"), str.size());
+        // adding the token to the list
+        result.push_back(str.substr(0, token_end));
+        // removing the token
+        str.remove_prefix(token_end);
+    }
+}
+
+// Using virtual dispatch, see VariantNode below for the std::variant version
+struct Node {
+    virtual ~Node() noexcept = default;
+    virtual int getNbChildren() noexcept = 0;
+    virtual double getValue(double* child_begin, double* child_end) noexcept = 0;
+};
+using NodePtr = std::unique_ptr<Node>;
+
+struct Number : Node {
+    double value;
+    Number(double v) noexcept : value{v} {}
+
+    // Number is a leaf node
+    virtual int getNbChildren() noexcept { return 0; }
+
+    virtual double getValue([[maybe_unused]] double* begin, [[maybe_unused]] double* end) noexcept
+    {
+        assert(begin == end); // ensures a number has no children
+        return value;
+    }
+};
+
+struct Operation : Node {
+    enum Op { Add, Sub, Mult, Div, Sqrt, Pow };
+    Op operation;
+
+    // Parsing the token
+    Operation(std::string_view token)
+    {
+        static constexpr std::string_view tokens[] = {"+", "-", "x", "/", "sqrt", "pow"};
+        if (auto it = std::find(std::begin(tokens), std::end(tokens), token);
+            it != std::end(tokens)) {
+            operation = static_cast<Op>(it - std::begin(tokens));
+        }
+        else
+            throw std::invalid_argument("Invalid token for Operation");
+    }
+
+    virtual int getNbChildren() noexcept
+    {
+        static constexpr int nb_children[] = {2, 2, 2, 2, 1, 2};
+        return nb_children[static_cast<int>(operation)];
+    }
+
+    virtual double getValue(double* it, [[maybe_unused]] double* end) noexcept
+    {
+        assert(it + getNbChildren() == end); // ensures it has the appropriate number of children
+        switch (operation) {
+        case Add: return it[0] + it[1];
+        case Sub: return it[0] - it[1];
+        case Mult: return it[0] * it[1];
+        case Div: return it[0] / it[1];
+        case Sqrt: return std::sqrt(it[0]);
+        case Pow: return std::pow(it[0], it[1]);
+        default: return 0;
+        }
+    }
+};
+
+// conversion from a token  to a node
+inline NodePtr token_to_node(std::string_view token)
+{
+    auto token_end = token.data() + token.size();
+    char* num_end = nullptr;
+    if (double value = std::strtod(token.data(), &num_end); num_end == token_end) {
+        return std::make_unique<Number>(value);
+    }
+    return std::make_unique<Operation>(token);
+}
+
+using MathTree = std::vector<NodePtr>;
+
+// conversion from a list of tokens to a MathTree
+inline MathTree parse_expression(std::string_view expression)
+{
+    auto tokens = split_tokens(expression);
+    MathTree tree(tokens.size());
+    std::transform(tokens.begin(), tokens.end(), tree.begin(), token_to_node);
+    return tree;
+}
+
+struct NodeTraits : jv::NodeTraits<MathTree::const_iterator, NodeTraits> {
+    // all the operations are unary or binary
+    static constexpr std::size_t maxChildren = 2;
+
+    static std::size_t getChildrenCount(iterator it) noexcept { return (*it)->getNbChildren(); }
+};
+
+inline double evaluate(MathTree const& tree) noexcept
+{
+    auto [value, _] = NodeTraits::evaluationTraversal<double>(
+        tree.begin(),
+        [](auto node, double* begin, double* end) { return (*node)->getValue(begin, end); });
+    return value;
+}
+
+inline double evaluate(std::string_view expression) noexcept
+{
+    return evaluate(parse_expression(expression));
+}
+
+// evaluation without heap allocation, throws std::length_error if the tree is deeper than 64
+inline double evaluate_bounded(MathTree const& tree)
+{
+    auto get_value = [](auto node, double* begin, double* end) {
+        return (*node)->getValue(begin, end);
+    };
+    return NodeTraits::boundedEvaluationTraversal<double, 64>(tree.begin(), get_value).first;
+}
+
+// lowering the tree once, to evaluate it many times without traversing it
+inline jv::PostfixProgram<Node*> compile(MathTree const& tree)
+{
+    return NodeTraits::compile(tree.begin(), [](auto node) { return node->get(); }).first;
+}
+
+// stack must contain at least program.stackSize() values
+inline double evaluate(jv::PostfixProgram<Node*> const& program, double* stack) noexcept
+{
+    return program.evaluate<double>(
+        [](Node* node, double* begin, double* end) { return node->getValue(begin, end); }, stack);
+}
+
+// Flat representation: one allocation-free pass from the text to the arity and payload columns
+
+// payload of a flat tree, the value is only used by numbers
+struct FlatNode {
+    enum Kind : std::uint8_t { Number, Add, Sub, Mult, Div, Sqrt, Pow };
+    Kind kind;
+    double value;
+};
+using FlatMathTree = jv::FlatTree<FlatNode, std::uint8_t>;
+
+// returns the operation of `token` and sets `nb_children`, or returns Number if it is not one
+inline FlatNode::Kind token_to_operation(std::string_view token, std::size_t& nb_children) noexcept
+{
+    nb_children = 2;
+    if (token.size() == 1) {
+        switch (token[0]) {
+        case '+': return FlatNode::Add;
+        case '-': return FlatNode::Sub;
+        case 'x': return FlatNode::Mult;
+        case '/': return FlatNode::Div;
+        }
+    }
+    else if (token == "pow") {
+        return FlatNode::Pow;
+    }
+    else if (token == "sqrt") {
+        nb_children = 1;
+        return FlatNode::Sqrt;
+    }
+    nb_children = 0;
+    return FlatNode::Number;
+}
+
+// calls `push(FlatNode node, std::size_t nb_children)` for each token of `expression`, in one pass
+// throws std::invalid_argument if a token is invalid, or if operands are missing or in excess
+template <typename Push>
+void parse_tokens(std::string_view expression, Push&& push)
+{
+    std::size_t pending = 1; // number of operands still expected
+    char const* it = expression.data();
+    char const* end = it + expression.size();
+    while (true) {
+        while (it != end && (*it == ' ' || *it == '\r' || *it == '\t' || *it == '\n'))
+            ++it;
+        if (it == end)
+            break;
+        char const* token_begin = it;
+        while (it != end && *it != ' ' && *it != '\r' && *it != '\t' && *it != '\n')
+            ++it;
+        std::string_view token(token_begin, it - token_begin);
+
+        if (pending == 0)
+            throw std::invalid_argument("Too many operands");
+        std::size_t nb_children;
+        FlatNode node{token_to_operation(token, nb_children), 0.0};
+        if (node.kind == FlatNode::Number) {
+            auto [number_end, error] = std::from_chars(token_begin, it, node.value);
+            if (error != std::errc{} || number_end != it)
+                throw std::invalid_argument("Invalid token");
+        }
+        pending = pending - 1 + nb_children;
+        push(node, nb_children);
+    }
+    if (pending != 0)
+        throw std::invalid_argument("Missing operands");
+}
+
+// parses `expression` into `tree`, which is cleared but keeps its capacity, so that parsing many
+// expressions into the same tree does not allocate
+inline void parse_expression(std::string_view expression, FlatMathTree& tree)
+{
+    tree.clear();
+    parse_tokens(expression, [&](FlatNode node, std::size_t nb_children) {
+        tree.push_back(node, nb_children);
+    });
+}
+
+// computes the value of `node` from the values of its children
+inline double get_value(FlatNode node, double const* it) noexcept
+{
+    switch (node.kind) {
+    case FlatNode::Number: return node.value;
+    case FlatNode::Add: return it[0] + it[1];
+    case FlatNode::Sub: return it[0] - it[1];
+    case FlatNode::Mult: return it[0] * it[1];
+    case FlatNode::Div: return it[0] / it[1];
+    case FlatNode::Sqrt: return std::sqrt(it[0]);
+    case FlatNode::Pow: return std::pow(it[0], it[1]);
+    default: return 0.0;
+    }
+}
+
+inline double evaluate(FlatMathTree const& tree) noexcept
+{
+    auto [value, _] = FlatMathTree::traits::evaluationTraversal<double>(
+        tree.begin(), [](auto node, double* it, double*) { return get_value(*node, it); });
+    return value;
+}
+
+// writes in `out` a copy of `tree` where the operations whose operands are all numbers are
+// replaced by their value, in one pass: "sqrt + pow 3 2 pow 4 2" becomes "sqrt + 9 16"
+inline void fold_constants(FlatMathTree const& tree, FlatMathTree& out)
+{
+    using Transform = jv::Transform<FlatNode, std::uint8_t>;
+    out.clear();
+    FlatMathTree::traits::transformTraversal(
+        tree.begin(),
+        [](FlatMathTree::iterator node) {
+            // while the operands are numbers, they are the next nodes
+            double operands[2];
+            std::size_t nb_children = node.arity();
+            for (std::size_t i = 0; i != nb_children; ++i) {
+                if (node[i + 1].kind != FlatNode::Number)
+                    return Transform::keep(*node);
+                operands[i] = node[i + 1].value;
+            }
+            if (nb_children == 0)
+                return Transform::keep(*node);
+            return Transform::leaf(FlatNode{FlatNode::Number, get_value(*node, operands)});
+        },
+        out, tree.size());
+}
+
+// Value-type nodes stored inline in the sequence, without indirection nor virtual calls:
+// the number of children is read from a table indexed by the alternative, and std::visit
+// dispatches the evaluation with a jump table
+
+namespace variant_nodes {
+
+struct Number {
+    static constexpr std::size_t nb_children = 0;
+    double value;
+    double apply(double const*) const noexcept { return value; }
+};
+
+struct Add {
+    static constexpr std::size_t nb_children = 2;
+    double apply(double const* it) const noexcept { return it[0] + it[1]; }
+};
+
+struct Sub {
+    static constexpr std::size_t nb_children = 2;
+    double apply(double const* it) const noexcept { return it[0] - it[1]; }
+};
+
+struct Mult {
+    static constexpr std::size_t nb_children = 2;
+    double apply(double const* it) const noexcept { return it[0] * it[1]; }
+};
+
+struct Div {
+    static constexpr std::size_t nb_children = 2;
+    double apply(double const* it) const noexcept { return it[0] / it[1]; }
+};
+
+struct Sqrt {
+    static constexpr std::size_t nb_children = 1;
+    double apply(double const* it) const noexcept { return std::sqrt(it[0]); }
+};
+
+struct Pow {
+    static constexpr std::size_t nb_children = 2;
+    double apply(double const* it) const noexcept { return std::pow(it[0], it[1]); }
+};
+
+} // namespace variant_nodes
+
+using VariantNode = std::variant<variant_nodes::Number,
+                                 variant_nodes::Add,
+                                 variant_nodes::Sub,
+                                 variant_nodes::Mult,
+                                 variant_nodes::Div,
+                                 variant_nodes::Sqrt,
+                                 variant_nodes::Pow>;
+using VariantMathTree = std::vector<VariantNode>;
+
+template <typename Variant>
+struct ArityTable;
+
+template <typename... Nodes>
+struct ArityTable<std::variant<Nodes...>> {
+    static constexpr std::size_t values[] = {Nodes::nb_children...};
+};
+
+struct VariantNodeTraits : jv::NodeTraits<VariantMathTree::const_iterator, VariantNodeTraits> {
+    static constexpr std::size_t maxChildren = 2;
+
+    static std::size_t getChildrenCount(iterator it) noexcept
+    {
+        return ArityTable<VariantNode>::values[it->index()];
+    }
+};
+
+inline VariantNode to_variant_node(FlatNode node) noexcept
+{
+    switch (node.kind) {
+    case FlatNode::Add: return variant_nodes::Add{};
+    case FlatNode::Sub: return variant_nodes::Sub{};
+    case FlatNode::Mult: return variant_nodes::Mult{};
+    case FlatNode::Div: return variant_nodes::Div{};
+    case FlatNode::Sqrt: return variant_nodes::Sqrt{};
+    case FlatNode::Pow: return variant_nodes::Pow{};
+    default: return variant_nodes::Number{node.value};
+    }
+}
+
+// parses `expression` into `tree`, which is cleared but keeps its capacity
+inline void parse_expression(std::string_view expression, VariantMathTree& tree)
+{
+    tree.clear();
+    parse_tokens(expression, [&](FlatNode node, std::size_t) {
+        tree.push_back(to_variant_node(node));
+    });
+}
+
+inline double get_value(VariantNode const& node, double* children) noexcept
+{
+    return std::visit([&](auto const& alternative) { return alternative.apply(children); }, node);
+}
+
+inline double evaluate(VariantMathTree const& tree) noexcept
+{
+    auto [value, _] = VariantNodeTraits::evaluationTraversal<double>(
+        tree.begin(), [](auto node, double* it, double*) { return get_value(*node, it); });
+    return value;
+}
+
+#endif
@@ -0,0 +1,297 @@
+//          Copyright Julien Vernay 2020.
+// Distributed under the Boost Software License, Version 1.0.
+//        (See accompanying file LICENSE or copy at
+//          https://www.boost.org/LICENSE_1_0.txt)
+
+#ifndef JVERNAY_UTILS_FLAT_TREE_FILE_HPP
+#define JVERNAY_UTILS_FLAT_TREE_FILE_HPP
+
+#include <jv/tree-algorithms.hpp>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define JVERNAY_UTILS_FLAT_TREE_FILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace jv {
+
+/// Header of the binary format of flat trees, written by `writeFlatTree`.
+/// It is followed by the arity column, the payload column, and optionally the subtree sizes
+/// of a SubtreeIndex. Each column starts at an offset multiple of `FlatTreeFileHeader::alignment`.
+/// The values are stored with the byte order of the writer, which is checked when loading.
+struct FlatTreeFileHeader {
+    static constexpr char expected_magic[8] = {'J', 'V', 'F', 'L', 'T', 'R', 'E', 'E'};
+    static constexpr std::uint32_t current_version = 1;
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+    static constexpr std::size_t alignment = 64;
+
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    std::uint32_t arity_size;
+    std::uint32_t payload_size;
+    std::uint64_t nb_nodes;
+    std::uint64_t arities_offset;
+    std::uint64_t payloads_offset;
+    std::uint64_t sizes_offset; // 0 if the file has no subtree sizes
+};
+
+namespace detail {
+
+    inline std::uint64_t alignFileOffset(std::uint64_t offset) noexcept
+    {
+        constexpr std::uint64_t mask = FlatTreeFileHeader::alignment - 1;
+        return (offset + mask) & ~mask;
+    }
+
+    /// Read-only content of a file, mapped in memory when the platform supports it, and read
+    /// into a buffer otherwise.
+    class MappedFile {
+    public:
+        /// Throws std::system_error if the file cannot be opened or mapped.
+        explicit MappedFile(std::string const& path)
+        {
+#ifdef JVERNAY_UTILS_FLAT_TREE_FILE_MMAP
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0)
+                throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+            struct stat info;
+            if (::fstat(fd, &info) != 0) {
+                int error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "cannot stat " + path);
+            }
+            size_ = static_cast<std::size_t>(info.st_size);
+            if (size_ != 0) {
+                void* data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+                if (data == MAP_FAILED) {
+                    int error = errno;
+                    ::close(fd);
+                    throw std::system_error(error, std::generic_category(), "cannot map " + path);
+                }
+                data_ = static_cast<unsigned char const*>(data);
+            }
+            ::close(fd); // the mapping stays valid
+#else
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (!file)
+                throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+            size_ = static_cast<std::size_t>(file.tellg());
+            buffer_.resize((size_ + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t));
+            file.seekg(0);
+            if (!file.read(reinterpret_cast<char*>(buffer_.data()), size_))
+                throw std::system_error(errno, std::generic_category(), "cannot read " + path);
+            data_ = reinterpret_cast<unsigned char const*>(buffer_.data());
+#endif
+        }
+
+        MappedFile(MappedFile&& other) noexcept
+            : data_{std::exchange(other.data_, nullptr)},
+              size_{std::exchange(other.size_, 0)}
+#ifndef JVERNAY_UTILS_FLAT_TREE_FILE_MMAP
+              ,
+              buffer_{std::move(other.buffer_)}
+#endif
+        {
+        }
+
+        MappedFile& operator=(MappedFile other) noexcept
+        {
+            std::swap(data_, other.data_);
+            std::swap(size_, other.size_);
+#ifndef JVERNAY_UTILS_FLAT_TREE_FILE_MMAP
+            std::swap(buffer_, other.buffer_);
+#endif
+            return *this;
+        }
+
+        ~MappedFile()
+        {
+#ifdef JVERNAY_UTILS_FLAT_TREE_FILE_MMAP
+            if (data_)
+                ::munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+        }
+
+        unsigned char const* data() const noexcept { return data_; }
+        std::size_t size() const noexcept { return size_; }
+
+    private:
+        unsigned char const* data_ = nullptr;
+        std::size_t size_ = 0;
+#ifndef JVERNAY_UTILS_FLAT_TREE_FILE_MMAP
+        std::vector<std::max_align_t> buffer_;
+#endif
+    };
+
+    /// Checks in one pass that `arities` is a sequence of complete trees, and that `sizes` (if
+    /// not null) are the sizes of their subtrees, so that traversals stay in the columns.
+    /// Throws std::runtime_error otherwise.
+    template <typename Arity>
+    void validateFlatTreeColumns(Arity const* arities,
+                                 std::uint32_t const* sizes,
+                                 std::size_t nb_nodes)
+    {
+        // nodes whose children are not all seen yet
+        struct Frame {
+            std::size_t node;
+            std::size_t remaining;
+        };
+        std::vector<Frame> stack;
+        for (std::size_t i = 0; i != nb_nodes; ++i) {
+            if (!stack.empty())
+                --stack.back().remaining;
+            stack.push_back({i, arities[i]});
+            // the subtrees ending at this node
+            while (!stack.empty() && stack.back().remaining == 0) {
+                if (sizes && sizes[stack.back().node] != i + 1 - stack.back().node)
+                    throw std::runtime_error("MappedFlatTree: corrupt subtree sizes");
+                stack.pop_back();
+            }
+        }
+        if (!stack.empty())
+            throw std::runtime_error("MappedFlatTree: corrupt arity column");
+    }
+
+} // namespace detail
+
+/// Writes `tree` in the binary format described by `FlatTreeFileHeader`.
+/// If `with_index` is true, the subtree sizes of a SubtreeIndex are computed and stored, so that
+/// loading the file does not need to build the index.
+/// Payload must be trivially copyable, since payloads are written as raw bytes.
+/// Throws std::runtime_error if writing fails, std::length_error if the index cannot be built.
+template <typename Payload, typename Arity>
+void writeFlatTree(std::ostream& out, FlatTreeView<Payload, Arity> tree, bool with_index = true)
+{
+    static_assert(std::is_trivially_copyable_v<Payload>,
+                  "writeFlatTree requires a trivially copyable Payload");
+
+    std::optional<SubtreeIndex<FlatTreeTraits<Payload, Arity>>> index;
+    if (with_index)
+        index.emplace(tree.begin(), tree.end());
+
+    FlatTreeFileHeader header{};
+    std::memcpy(header.magic, FlatTreeFileHeader::expected_magic, sizeof(header.magic));
+    header.version = FlatTreeFileHeader::current_version;
+    header.byte_order = FlatTreeFileHeader::byte_order_mark;
+    header.arity_size = sizeof(Arity);
+    header.payload_size = sizeof(Payload);
+    header.nb_nodes = tree.size();
+    header.arities_offset = detail::alignFileOffset(sizeof(header));
+    header.payloads_offset =
+        detail::alignFileOffset(header.arities_offset + tree.size() * sizeof(Arity));
+    if (with_index)
+        header.sizes_offset =
+            detail::alignFileOffset(header.payloads_offset + tree.size() * sizeof(Payload));
+
+    std::uint64_t position = 0;
+    auto write = [&](std::uint64_t offset, void const* data, std::size_t size) {
+        static constexpr char padding[FlatTreeFileHeader::alignment] = {};
+        out.write(padding, static_cast<std::streamsize>(offset - position));
+        out.write(static_cast<char const*>(data), static_cast<std::streamsize>(size));
+        position = offset + size;
+    };
+    write(0, &header, sizeof(header));
+    write(header.arities_offset, tree.arities(), tree.size() * sizeof(Arity));
+    write(header.payloads_offset, tree.payloads(), tree.size() * sizeof(Payload));
+    if (with_index)
+        write(header.sizes_offset, index->sizes(), tree.size() * sizeof(std::uint32_t));
+
+    if (!out)
+        throw std::runtime_error("writeFlatTree: cannot write the tree");
+}
+
+/// FlatTree loaded from a file written by `writeFlatTree`, without copying or parsing it: the file
+/// is mapped in memory (or read in one call on platforms without `mmap`), and `view()` points into
+/// it. By default, the arity column and the subtree sizes are checked in one linear pass, since
+/// traversals rely on them to stay in the mapped memory. For trusted files, `validate = false`
+/// skips this pass: loading is then independent of the size of the tree, and pages are read on
+/// first access.
+template <typename Payload, typename Arity = std::uint32_t>
+class MappedFlatTree {
+public:
+    using traits = FlatTreeTraits<Payload, Arity>;
+    using iterator = FlatTreeIterator<Payload, Arity>;
+
+    static_assert(std::is_trivially_copyable_v<Payload>,
+                  "MappedFlatTree requires a trivially copyable Payload");
+    static_assert(alignof(Payload) <= FlatTreeFileHeader::alignment &&
+                      alignof(Arity) <= FlatTreeFileHeader::alignment,
+                  "the columns are not aligned enough for Payload");
+
+    /// Throws std::system_error if the file cannot be read, and std::runtime_error if it is not a
+    /// flat tree of `Payload` and `Arity`, if it is truncated, or if `validate` is true and the
+    /// columns are not consistent.
+    explicit MappedFlatTree(std::string const& path, bool validate = true) : file_(path)
+    {
+        FlatTreeFileHeader header;
+        if (file_.size() < sizeof(header))
+            throw std::runtime_error("MappedFlatTree: file is too small");
+        std::memcpy(&header, file_.data(), sizeof(header));
+        if (std::memcmp(header.magic, FlatTreeFileHeader::expected_magic, sizeof(header.magic)))
+            throw std::runtime_error("MappedFlatTree: not a flat tree file");
+        if (header.version != FlatTreeFileHeader::current_version)
+            throw std::runtime_error("MappedFlatTree: unsupported version");
+        if (header.byte_order != FlatTreeFileHeader::byte_order_mark)
+            throw std::runtime_error("MappedFlatTree: written with another byte order");
+        if (header.arity_size != sizeof(Arity) || header.payload_size != sizeof(Payload))
+            throw std::runtime_error("MappedFlatTree: mismatching Arity or Payload");
+
+        std::uint64_t nb_nodes = header.nb_nodes;
+        auto column = [&](std::uint64_t offset, std::size_t element_size) {
+            if (offset % FlatTreeFileHeader::alignment != 0 || offset > file_.size() ||
+                nb_nodes > (file_.size() - offset) / element_size)
+                throw std::runtime_error("MappedFlatTree: truncated file");
+            return file_.data() + offset;
+        };
+        auto arities = reinterpret_cast<Arity const*>(column(header.arities_offset, sizeof(Arity)));
+        auto payloads =
+            reinterpret_cast<Payload const*>(column(header.payloads_offset, sizeof(Payload)));
+        view_ = {arities, payloads, static_cast<std::size_t>(nb_nodes)};
+        std::uint32_t const* sizes = nullptr;
+        if (header.sizes_offset != 0) {
+            sizes = reinterpret_cast<std::uint32_t const*>(
+                column(header.sizes_offset, sizeof(std::uint32_t)));
+            index_.emplace(view_.begin(), sizes, view_.size());
+        }
+        if (validate)
+            detail::validateFlatTreeColumns(arities, sizes, view_.size());
+    }
+
+    /// Returns the tree, which is valid as long as this object.
+    FlatTreeView<Payload, Arity> const& view() const noexcept { return view_; }
+
+    std::size_t size() const noexcept { return view_.size(); }
+    bool empty() const noexcept { return view_.empty(); }
+    iterator begin() const noexcept { return view_.begin(); }
+    iterator end() const noexcept { return view_.end(); }
+
+    /// Returns the index stored in the file, or null if it was written without index.
+    SubtreeIndex<traits> const* index() const noexcept { return index_ ? &*index_ : nullptr; }
+
+private:
+    detail::MappedFile file_;
+    FlatTreeView<Payload, Arity> view_;
+    std::optional<SubtreeIndex<traits>> index_;
+};
+
+} // namespace jv
+
+#endif
@@ -6,14 +6,1159 @@
 #ifndef JVERNAY_UTILS_TREE_ALGORITHMS_HPP
 #define JVERNAY_UTILS_TREE_ALGORITHMS_HPP
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <stdexcept>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace jv {
 
+namespace detail {
+
+    /// Pending state of a node whose children are being visited by an iterative traversal.
+    template <typename Iterator>
+    struct TraversalFrame {
+        Iterator node;
+        std::size_t remaining; // number of children not visited yet
+    };
+
+    /// Same as TraversalFrame, also storing where the children's values begin.
+    template <typename Iterator>
+    struct EvaluationFrame {
+        Iterator node;
+        std::size_t remaining;
+        std::size_t first_value;
+    };
+
+    template <typename Allocator, typename T>
+    using RebindAlloc = typename std::allocator_traits<Allocator>::template rebind_alloc<T>;
+
+    template <typename Iterator, typename Category>
+    constexpr bool has_iterator_category_v = std::is_base_of_v<
+        Category, typename std::iterator_traits<Iterator>::iterator_category>;
+
+    template <typename Iterator>
+    constexpr bool is_random_access_v =
+        has_iterator_category_v<Iterator, std::random_access_iterator_tag>;
+
+} // namespace detail
+
+/// Runs tasks on a fixed number of threads, including the calling thread.
+/// Executors are invoked with `(std::size_t count, Task task)`, and must call `task(i)` for every
+/// `i` in [0, count), possibly concurrently, before returning.
+/// Tasks are distributed dynamically: each thread takes the next pending task when it is free.
+class ThreadExecutor {
+public:
+    ThreadExecutor() noexcept : ThreadExecutor(std::thread::hardware_concurrency()) {}
+
+    explicit ThreadExecutor(std::size_t nb_threads) noexcept
+        : nb_threads_{std::max<std::size_t>(nb_threads, 1)}
+    {
+    }
+
+    /// Returns the number of threads used to run the tasks.
+    std::size_t concurrency() const noexcept { return nb_threads_; }
+
+    /// Calls `task(i)` for each `i` in [0, count). Rethrows the first exception thrown by a task.
+    template <typename Task>
+    void operator()(std::size_t count, Task&& task) const
+    {
+        std::atomic<std::size_t> next_task{0};
+        std::exception_ptr error;
+        std::mutex error_mutex;
+
+        auto worker = [&] {
+            for (std::size_t i; (i = next_task.fetch_add(1)) < count;) {
+                try {
+                    task(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(error_mutex);
+                    if (!error)
+                        error = std::current_exception();
+                    next_task = count; // cancels the remaining tasks
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        std::size_t nb_threads = std::min(nb_threads_, count);
+        for (std::size_t i = 1; i < nb_threads; ++i)
+            threads.emplace_back(worker);
+        worker();
+        for (auto& thread : threads)
+            thread.join();
+
+        if (error)
+            std::rethrow_exception(error);
+    }
+
+private:
+    std::size_t nb_threads_;
+};
+
+/// Pack of `N` values of type `T`, one per input lane, with element-wise arithmetic.
+/// The operations are plain loops over the lanes, which compilers turn into SIMD instructions.
+/// See `NodeTraits::batchEvaluationTraversal`.
+template <typename T, std::size_t N>
+struct Lanes {
+    static constexpr std::size_t size = N;
+    T lanes[N];
+
+    /// Returns a pack whose lanes are all equal to `value`.
+    static constexpr Lanes broadcast(T value) noexcept
+    {
+        Lanes result{};
+        for (std::size_t i = 0; i != N; ++i)
+            result.lanes[i] = value;
+        return result;
+    }
+
+    /// Returns the pack `{ func(lanes[0]), func(lanes[1]), ... }`.
+    template <typename Func>
+    constexpr Lanes map(Func&& func) const
+    {
+        Lanes result{};
+        for (std::size_t i = 0; i != N; ++i)
+            result.lanes[i] = func(lanes[i]);
+        return result;
+    }
+
+    constexpr T& operator[](std::size_t i) noexcept { return lanes[i]; }
+    constexpr T const& operator[](std::size_t i) const noexcept { return lanes[i]; }
+
+    /// Returns the pack `{ func(lhs[0], rhs[0]), func(lhs[1], rhs[1]), ... }`.
+    template <typename Func>
+    friend constexpr Lanes zip(Lanes const& lhs, Lanes const& rhs, Func&& func)
+    {
+        Lanes result{};
+        for (std::size_t i = 0; i != N; ++i)
+            result.lanes[i] = func(lhs.lanes[i], rhs.lanes[i]);
+        return result;
+    }
+
+    friend constexpr Lanes operator+(Lanes const& lhs, Lanes const& rhs) noexcept
+    {
+        return zip(lhs, rhs, std::plus<T>{});
+    }
+    friend constexpr Lanes operator-(Lanes const& lhs, Lanes const& rhs) noexcept
+    {
+        return zip(lhs, rhs, std::minus<T>{});
+    }
+    friend constexpr Lanes operator*(Lanes const& lhs, Lanes const& rhs) noexcept
+    {
+        return zip(lhs, rhs, std::multiplies<T>{});
+    }
+    friend constexpr Lanes operator/(Lanes const& lhs, Lanes const& rhs) noexcept
+    {
+        return zip(lhs, rhs, std::divides<T>{});
+    }
+
+    constexpr Lanes& operator+=(Lanes const& rhs) noexcept { return *this = *this + rhs; }
+    constexpr Lanes& operator-=(Lanes const& rhs) noexcept { return *this = *this - rhs; }
+    constexpr Lanes& operator*=(Lanes const& rhs) noexcept { return *this = *this * rhs; }
+    constexpr Lanes& operator/=(Lanes const& rhs) noexcept { return *this = *this / rhs; }
+};
+
+/// Memory resource optimized for the LIFO allocations made by the traversals.
+/// Allocations bump a pointer in the current block, and deallocating the last allocation pops it.
+/// Other deallocations are only reclaimed by `reset()`, or when the arena is destroyed.
+/// When the current block is full, a block twice as large is allocated on the heap.
+/// Use `ArenaAllocator<T>` to pass it to the traversals, and `InlineArena` to start with a buffer
+/// on the native stack.
+class StackArena {
+public:
+    explicit StackArena(std::size_t initial_size = 1024) noexcept : next_block_size_{initial_size}
+    {
+    }
+
+    /// Starts by allocating memory from `buffer`, which must outlive the arena.
+    StackArena(void* buffer, std::size_t size) noexcept
+        : current_{static_cast<unsigned char*>(buffer)},
+          end_{current_ + size},
+          buffer_{current_},
+          next_block_size_{2 * size}
+    {
+    }
+
+    StackArena(StackArena const&) = delete;
+    StackArena& operator=(StackArena const&) = delete;
+
+    ~StackArena() { releaseBlocks(nullptr); }
+
+    void* allocate(std::size_t size, std::size_t alignment)
+    {
+        if (void* ptr = bump(size, alignment))
+            return ptr;
+
+        // the current block is full, allocating a new block with room for the block header
+        std::size_t block_size = std::max(next_block_size_, size + alignment + sizeof(Block));
+        auto block = static_cast<Block*>(::operator new(block_size));
+        block->previous = blocks_;
+        block->size = block_size;
+        blocks_ = block;
+        current_ = reinterpret_cast<unsigned char*>(block + 1);
+        end_ = reinterpret_cast<unsigned char*>(block) + block_size;
+        next_block_size_ = 2 * block_size;
+        return bump(size, alignment);
+    }
+
+    void deallocate(void* ptr, std::size_t size) noexcept
+    {
+        // only the last allocation can be reclaimed
+        if (static_cast<unsigned char*>(ptr) + size == current_)
+            current_ = static_cast<unsigned char*>(ptr);
+    }
+
+    /// Reclaims all the allocations. Only the most recent (and largest) block is kept,
+    /// so that repeated traversals end up not allocating from the heap.
+    void reset() noexcept
+    {
+        if (blocks_) {
+            releaseBlocks(blocks_);
+            blocks_->previous = nullptr;
+            current_ = reinterpret_cast<unsigned char*>(blocks_ + 1);
+            end_ = reinterpret_cast<unsigned char*>(blocks_) + blocks_->size;
+        }
+        else {
+            current_ = buffer_;
+        }
+    }
+
+private:
+    struct alignas(std::max_align_t) Block {
+        Block* previous;
+        std::size_t size;
+    };
+
+    void* bump(std::size_t size, std::size_t alignment) noexcept
+    {
+        auto address = reinterpret_cast<std::uintptr_t>(current_);
+        auto aligned = (address + alignment - 1) & ~(std::uintptr_t(alignment) - 1);
+        if (current_ == nullptr || aligned - address > std::size_t(end_ - current_) ||
+            size > std::size_t(end_ - current_) - (aligned - address))
+            return nullptr;
+        current_ += (aligned - address) + size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // releases the heap blocks allocated before `kept`
+    void releaseBlocks(Block* kept) noexcept
+    {
+        Block* block = kept ? kept->previous : blocks_;
+        while (block) {
+            Block* previous = block->previous;
+            ::operator delete(block);
+            block = previous;
+        }
+    }
+
+    unsigned char* current_ = nullptr;
+    unsigned char* end_ = nullptr;
+    unsigned char* buffer_ = nullptr; // initial buffer provided by the user
+    Block* blocks_ = nullptr;         // last heap block allocated
+    std::size_t next_block_size_;
+};
+
+namespace detail {
+
+    template <std::size_t Size>
+    struct InlineBuffer {
+        alignas(std::max_align_t) unsigned char inline_buffer[Size];
+    };
+
+} // namespace detail
+
+/// StackArena starting with a buffer of `Size` bytes stored inline, for instance on the native
+/// stack. For instance, `InlineArena<64 * sizeof(Value)>` avoids any heap allocation when
+/// evaluating shallow trees.
+template <std::size_t Size>
+class InlineArena : private detail::InlineBuffer<Size>, public StackArena {
+public:
+    InlineArena() noexcept : StackArena(this->inline_buffer, Size) {}
+};
+
+/// Allocator allocating from a StackArena, which must outlive it.
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    ArenaAllocator(StackArena& arena) noexcept : arena_{&arena} {}
+
+    template <typename U>
+    ArenaAllocator(ArenaAllocator<U> const& other) noexcept : arena_{other.arena()}
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept { arena_->deallocate(ptr, n * sizeof(T)); }
+
+    StackArena* arena() const noexcept { return arena_; }
+
+    template <typename U>
+    friend bool operator==(ArenaAllocator const& lhs, ArenaAllocator<U> const& rhs) noexcept
+    {
+        return lhs.arena() == rhs.arena();
+    }
+    template <typename U>
+    friend bool operator!=(ArenaAllocator const& lhs, ArenaAllocator<U> const& rhs) noexcept
+    {
+        return lhs.arena() != rhs.arena();
+    }
+
+private:
+    StackArena* arena_;
+};
+
+/// Instrumentation policy of the traversals, which records nothing. Traits select a policy with
+/// `NodeTraits::Instrumentation`. Each traversal creates a `Probe` when it starts, which is
+/// notified of its work, and destroys it when it ends. Resumable traversals create one probe per
+/// call of `resume`. The hooks of this policy are empty, so they are optimized away.
+struct NoInstrumentation {
+    struct Probe {
+        /// A node is given to the callback.
+        void onNode() noexcept {}
+        /// `getNextSibling` is called to skip a subtree.
+        void onSiblingScan() noexcept {}
+        /// A stack of the traversal (ancestors, frames or values) grows to `size` elements.
+        void onStackDepth(std::size_t) noexcept {}
+        /// A stack of the traversal is full, and grows its buffer.
+        void onReallocation() noexcept {}
+    };
+};
+
+/// Counts of the work done by traversals, see `CountingInstrumentation`.
+struct TraversalStats {
+    std::uint64_t traversals = 0;
+    std::uint64_t nodes = 0;
+    std::uint64_t sibling_scans = 0;
+    std::uint64_t reallocations = 0;
+    std::uint64_t max_stack_depth = 0; // maximum over the traversals
+    std::uint64_t elapsed_ns = 0;      // wall-clock time, including the callbacks
+
+    /// Calls `func(char const* name, std::uint64_t value)` for each counter, for instance to
+    /// export them to a metrics system.
+    template <typename Func>
+    void forEach(Func&& func) const
+    {
+        func("traversals", traversals);
+        func("nodes", nodes);
+        func("sibling_scans", sibling_scans);
+        func("reallocations", reallocations);
+        func("max_stack_depth", max_stack_depth);
+        func("elapsed_ns", elapsed_ns);
+    }
+};
+
+/// Totals of `TraversalStats`, which can be read while traversals run on other threads.
+class TraversalCounters {
+public:
+    /// Adds the counts of a traversal.
+    void add(TraversalStats const& stats) noexcept
+    {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        traversals_.fetch_add(stats.traversals, relaxed);
+        nodes_.fetch_add(stats.nodes, relaxed);
+        sibling_scans_.fetch_add(stats.sibling_scans, relaxed);
+        reallocations_.fetch_add(stats.reallocations, relaxed);
+        elapsed_ns_.fetch_add(stats.elapsed_ns, relaxed);
+        std::uint64_t depth = max_stack_depth_.load(relaxed);
+        while (depth < stats.max_stack_depth &&
+               !max_stack_depth_.compare_exchange_weak(depth, stats.max_stack_depth, relaxed))
+            ;
+    }
+
+    /// Returns the current totals. Each counter is read atomically, but not all of them at once.
+    TraversalStats snapshot() const noexcept
+    {
+        constexpr auto relaxed = std::memory_order_relaxed;
+        TraversalStats stats;
+        stats.traversals = traversals_.load(relaxed);
+        stats.nodes = nodes_.load(relaxed);
+        stats.sibling_scans = sibling_scans_.load(relaxed);
+        stats.reallocations = reallocations_.load(relaxed);
+        stats.max_stack_depth = max_stack_depth_.load(relaxed);
+        stats.elapsed_ns = elapsed_ns_.load(relaxed);
+        return stats;
+    }
+
+    void reset() noexcept
+    {
+        for (auto* counter : {&traversals_, &nodes_, &sibling_scans_, &reallocations_,
+                              &max_stack_depth_, &elapsed_ns_})
+            counter->store(0, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<std::uint64_t> traversals_{0};
+    std::atomic<std::uint64_t> nodes_{0};
+    std::atomic<std::uint64_t> sibling_scans_{0};
+    std::atomic<std::uint64_t> reallocations_{0};
+    std::atomic<std::uint64_t> max_stack_depth_{0};
+    std::atomic<std::uint64_t> elapsed_ns_{0};
+};
+
+/// Instrumentation policy counting the work of the traversals into `counters()`.
+/// `Tag` distinguishes sets of counters, for instance one per traits.
+/// The counts are kept in the probe during the traversal, and added to the shared counters
+/// once, when it ends: the hot path does not touch shared memory, but reads a clock twice per
+/// traversal.
+template <typename Tag = void>
+struct CountingInstrumentation {
+    static TraversalCounters& counters() noexcept
+    {
+        static TraversalCounters counters;
+        return counters;
+    }
+
+    class Probe {
+    public:
+        Probe() noexcept : start_{std::chrono::steady_clock::now()} { stats_.traversals = 1; }
+        Probe(Probe const&) = delete;
+        Probe& operator=(Probe const&) = delete;
+
+        ~Probe()
+        {
+            auto elapsed = std::chrono::steady_clock::now() - start_;
+            stats_.elapsed_ns = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            counters().add(stats_);
+        }
+
+        void onNode() noexcept { ++stats_.nodes; }
+        void onSiblingScan() noexcept { ++stats_.sibling_scans; }
+        void onStackDepth(std::size_t size) noexcept
+        {
+            stats_.max_stack_depth = std::max<std::uint64_t>(stats_.max_stack_depth, size);
+        }
+        void onReallocation() noexcept { ++stats_.reallocations; }
+
+    private:
+        TraversalStats stats_;
+        std::chrono::steady_clock::time_point start_;
+    };
+};
+
+namespace detail {
+
+    /// Appends an element to a stack of a traversal, notifying `probe` of its growth.
+    template <typename Probe, typename Stack, typename... Args>
+    void pushInstrumented(Probe& probe, Stack& stack, Args&&... args)
+    {
+        if (stack.size() == stack.capacity())
+            probe.onReallocation();
+        stack.emplace_back(std::forward<Args>(args)...);
+        probe.onStackDepth(stack.size());
+    }
+
+} // namespace detail
+
+/// Buffers used by traversals, owned by the caller so that their capacity is kept between calls.
+/// `stack` holds the ancestors or the values, `frames` holds the nodes being visited.
+template <typename Iterator, typename T, typename Allocator = std::allocator<T>>
+struct TraversalWorkspace {
+    using Frame = detail::EvaluationFrame<Iterator>;
+
+    std::vector<T, Allocator> stack;
+    std::vector<Frame, detail::RebindAlloc<Allocator, Frame>> frames;
+
+    explicit TraversalWorkspace(Allocator alloc = {}) : stack(alloc), frames(alloc) {}
+
+    /// Reserves the buffers for trees of depth `depth` (see `NodeTraits::getDepth`).
+    /// `nb_values` is the capacity of `stack`, which holds more than `depth` values if
+    /// evaluated nodes have several children.
+    void reserve(std::size_t depth, std::size_t nb_values = 0)
+    {
+        stack.reserve(std::max(depth, nb_values));
+        frames.reserve(depth);
+    }
+};
+
+template <typename Traits>
+class SubtreeIndex;
+
+template <typename Payload, typename Arity>
+class FlatTree;
+
+template <typename Payload, typename Arity>
+class Transform;
+
+/// Returns a 64-bit hash of `value` mixed into `seed`, which depends on the order of the
+/// combined values. It uses the finalizer of splitmix64.
+constexpr std::uint64_t hashCombine(std::uint64_t seed, std::uint64_t value) noexcept
+{
+    std::uint64_t x = seed + 0x9e3779b97f4a7c15 + value * 0xff51afd7ed558ccd;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+/// Links between the nodes of a sequence, using their positions in the sequence.
+/// See `NodeTraits::unflatten`.
+struct TreeLinks {
+    /// Parent of the roots.
+    static constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+    /// Position of the parent of each node.
+    std::vector<std::size_t> parents;
+    /// The children of node `i` are `children[child_offsets[i]]` to `children[child_offsets[i+1]]`
+    /// (excluded). This vector has one more element than the number of nodes.
+    std::vector<std::size_t> child_offsets;
+    std::vector<std::size_t> children;
+};
+
+/// Returned by the callbacks of `NodeTraits::visitTraversal` and `NodeTraits::ancestorsTraversal`
+/// to prune the traversal.
+enum class Visit {
+    Continue,    // visits the children of the node
+    SkipSubtree, // does not visit the children of the node, but visits its next sibling
+    Stop,        // stops the traversal immediately
+};
+
+namespace detail {
+
+    // forward iterators can be copied to look ahead, input iterators are single-pass
+    template <typename Iterator>
+    using ViewIteratorCategory =
+        std::conditional_t<has_iterator_category_v<Iterator, std::forward_iterator_tag>,
+                           std::forward_iterator_tag,
+                           std::input_iterator_tag>;
+
+    template <typename Traits>
+    typename Traits::iterator nextSibling(typename Traits::iterator node,
+                                          SubtreeIndex<Traits> const* index) noexcept
+    {
+        return index ? index->getNextSibling(node) : Traits::getNextSibling(node);
+    }
+
+} // namespace detail
+
+/// Range of the children of a node, see `NodeTraits::children`.
+/// Advancing calls `getNextSibling`, except after the last child.
+template <typename Traits>
+class ChildrenView {
+public:
+    using node_iterator = typename Traits::iterator;
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = node_iterator;
+        using difference_type = std::ptrdiff_t;
+        using pointer = node_iterator const*;
+        using reference = node_iterator const&;
+
+        iterator() = default;
+        iterator(node_iterator node, std::size_t remaining, SubtreeIndex<Traits> const* index)
+            : node_{node}, remaining_{remaining}, index_{index}
+        {
+        }
+
+        reference operator*() const noexcept { return node_; }
+        pointer operator->() const noexcept { return &node_; }
+
+        iterator& operator++()
+        {
+            if (--remaining_ != 0)
+                node_ = detail::nextSibling(node_, index_);
+            return *this;
+        }
+        iterator operator++(int) { return std::exchange(*this, std::next(*this)); }
+
+        friend bool operator==(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return lhs.remaining_ == rhs.remaining_;
+        }
+        friend bool operator!=(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return lhs.remaining_ != rhs.remaining_;
+        }
+
+    private:
+        node_iterator node_{};
+        std::size_t remaining_ = 0; // children left, including `node_`
+        SubtreeIndex<Traits> const* index_ = nullptr;
+    };
+
+    explicit ChildrenView(node_iterator node, SubtreeIndex<Traits> const* index = nullptr)
+        : first_{std::next(node), Traits::getChildrenCount(node), index}
+    {
+    }
+
+    iterator begin() const noexcept { return first_; }
+    iterator end() const noexcept { return {}; }
+    std::size_t size() const noexcept { return std::distance(first_, end()); }
+    bool empty() const noexcept { return first_ == end(); }
+
+private:
+    iterator first_;
+};
+
+/// Range of the nodes of a tree in preorder, see `NodeTraits::preorder`.
+/// The end of the tree is found while iterating, without scanning the tree beforehand.
+template <typename Traits>
+class PreorderView {
+public:
+    using node_iterator = typename Traits::iterator;
+
+    class iterator {
+    public:
+        using iterator_category = detail::ViewIteratorCategory<node_iterator>;
+        using value_type = node_iterator;
+        using difference_type = std::ptrdiff_t;
+        using pointer = node_iterator const*;
+        using reference = node_iterator const&;
+
+        iterator() = default;
+        explicit iterator(node_iterator root) : node_{root}, remaining_{1} {}
+
+        reference operator*() const noexcept { return node_; }
+        pointer operator->() const noexcept { return &node_; }
+
+        iterator& operator++()
+        {
+            remaining_ = remaining_ + Traits::getChildrenCount(node_) - 1;
+            ++node_;
+            return *this;
+        }
+        iterator operator++(int) { return std::exchange(*this, std::next(*this)); }
+
+        /// Returns the next node, which is the end of the tree once the iteration is done.
+        node_iterator base() const noexcept { return node_; }
+
+        friend bool operator==(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return lhs.remaining_ == rhs.remaining_ &&
+                   (lhs.remaining_ == 0 || lhs.node_ == rhs.node_);
+        }
+        friend bool operator!=(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+    private:
+        node_iterator node_{};
+        std::size_t remaining_ = 0; // nodes left in the tree, including `node_`
+    };
+
+    explicit PreorderView(node_iterator root) : root_{root} {}
+
+    iterator begin() const { return iterator(root_); }
+    iterator end() const noexcept { return {}; }
+
+private:
+    node_iterator root_;
+};
+
+/// Range of the leaves of a tree in preorder, see `NodeTraits::leaves`.
+template <typename Traits>
+class LeavesView {
+public:
+    using node_iterator = typename Traits::iterator;
+
+    class iterator {
+    public:
+        using iterator_category = detail::ViewIteratorCategory<node_iterator>;
+        using value_type = node_iterator;
+        using difference_type = std::ptrdiff_t;
+        using pointer = node_iterator const*;
+        using reference = node_iterator const&;
+
+        iterator() = default;
+        explicit iterator(node_iterator root) : node_{root}, remaining_{1} { skipInnerNodes(); }
+
+        reference operator*() const noexcept { return node_; }
+        pointer operator->() const noexcept { return &node_; }
+
+        iterator& operator++()
+        {
+            --remaining_; // `node_` is a leaf
+            ++node_;
+            skipInnerNodes();
+            return *this;
+        }
+        iterator operator++(int) { return std::exchange(*this, std::next(*this)); }
+
+        friend bool operator==(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return lhs.remaining_ == rhs.remaining_ &&
+                   (lhs.remaining_ == 0 || lhs.node_ == rhs.node_);
+        }
+        friend bool operator!=(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+    private:
+        void skipInnerNodes()
+        {
+            while (remaining_ != 0) {
+                std::size_t nb_children = Traits::getChildrenCount(node_);
+                if (nb_children == 0)
+                    return;
+                remaining_ = remaining_ + nb_children - 1;
+                ++node_;
+            }
+        }
+
+        node_iterator node_{};
+        std::size_t remaining_ = 0; // nodes left in the tree, including `node_`
+    };
+
+    explicit LeavesView(node_iterator root) : root_{root} {}
+
+    iterator begin() const { return iterator(root_); }
+    iterator end() const noexcept { return {}; }
+
+private:
+    node_iterator root_;
+};
+
+/// Range of the ancestors of a node, from the root to the node itself, see
+/// `NodeTraits::ancestors`. Each step scans the children of the current ancestor to find the one
+/// containing the node, using `getNextSibling` or a `SubtreeIndex`.
+template <typename Traits>
+class AncestorsView {
+public:
+    using node_iterator = typename Traits::iterator;
+
+    static_assert(detail::is_random_access_v<node_iterator>,
+                  "AncestorsView requires random-access iterators");
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = node_iterator;
+        using difference_type = std::ptrdiff_t;
+        using pointer = node_iterator const*;
+        using reference = node_iterator const&;
+
+        iterator() = default;
+        iterator(node_iterator root, node_iterator target, SubtreeIndex<Traits> const* index)
+            : node_{root}, target_{target}, index_{index}, done_{false}
+        {
+        }
+
+        reference operator*() const noexcept { return node_; }
+        pointer operator->() const noexcept { return &node_; }
+
+        iterator& operator++()
+        {
+            if (node_ == target_) {
+                done_ = true;
+                return *this;
+            }
+            // the target is in the subtree of the first child whose next sibling is after it
+            node_iterator child = node_ + 1, next;
+            while ((next = detail::nextSibling(child, index_)) <= target_)
+                child = next;
+            node_ = child;
+            return *this;
+        }
+        iterator operator++(int) { return std::exchange(*this, std::next(*this)); }
+
+        friend bool operator==(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return lhs.done_ == rhs.done_ && (lhs.done_ || lhs.node_ == rhs.node_);
+        }
+        friend bool operator!=(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return !(lhs == rhs);
+        }
+
+    private:
+        node_iterator node_{};
+        node_iterator target_{};
+        SubtreeIndex<Traits> const* index_ = nullptr;
+        bool done_ = true;
+    };
+
+    /// `node` must be in the subtree of `root`.
+    AncestorsView(node_iterator root, node_iterator node, SubtreeIndex<Traits> const* index)
+        : first_{root, node, index}
+    {
+    }
+
+    iterator begin() const noexcept { return first_; }
+    iterator end() const noexcept { return {}; }
+
+private:
+    iterator first_;
+};
+
+/// Single-pass range of the nodes of a tree in postorder, see `NodeTraits::postorder`.
+/// The view owns the stack of the nodes whose children are being visited, so it cannot be copied,
+/// and `begin()` must be called once.
+template <typename Traits>
+class PostorderView {
+public:
+    using node_iterator = typename Traits::iterator;
+
+    class iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = node_iterator;
+        using difference_type = std::ptrdiff_t;
+        using pointer = node_iterator const*;
+        using reference = node_iterator const&;
+
+        iterator() = default;
+        explicit iterator(PostorderView* view) noexcept : view_{view} {}
+
+        reference operator*() const noexcept { return view_->current_; }
+        pointer operator->() const noexcept { return &view_->current_; }
+
+        iterator& operator++()
+        {
+            if (!view_->advance())
+                view_ = nullptr;
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        friend bool operator==(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return lhs.view_ == rhs.view_;
+        }
+        friend bool operator!=(iterator const& lhs, iterator const& rhs) noexcept
+        {
+            return lhs.view_ != rhs.view_;
+        }
+
+    private:
+        PostorderView* view_ = nullptr; // null at the end
+    };
+
+    explicit PostorderView(node_iterator root) : next_{root}
+    {
+        stack_.push_back({next_, Traits::getChildrenCount(next_)});
+        ++next_;
+    }
+
+    PostorderView(PostorderView const&) = delete;
+    PostorderView& operator=(PostorderView const&) = delete;
+
+    iterator begin() { return iterator(advance() ? this : nullptr); }
+    iterator end() noexcept { return {}; }
+
+    /// Returns the node following the last visited node, which is the end of the tree once the
+    /// iteration is done.
+    node_iterator base() const noexcept { return next_; }
+
+private:
+    // moves `current_` to the next node in postorder, returns false at the end of the tree
+    bool advance()
+    {
+        while (!stack_.empty()) {
+            auto& top = stack_.back();
+            if (top.remaining == 0) {
+                current_ = top.node;
+                stack_.pop_back();
+                return true;
+            }
+            --top.remaining;
+            std::size_t nb_children = Traits::getChildrenCount(next_);
+            if (nb_children == 0) {
+                current_ = next_;
+                ++next_;
+                return true;
+            }
+            stack_.push_back({next_, nb_children});
+            ++next_;
+        }
+        return false;
+    }
+
+    node_iterator current_{};
+    node_iterator next_;
+    std::vector<detail::TraversalFrame<node_iterator>> stack_;
+};
+
+/// State of an `iterativeAncestorsTraversal` which runs in slices, see
+/// `NodeTraits::resumableAncestorsTraversal`. The ancestors and the pending frames are stored in
+/// the object, so a traversal can be suspended after any node, and resumed later.
+template <typename Traits, typename Func>
+class ResumableAncestorsTraversal {
+public:
+    using node_iterator = typename Traits::iterator;
+
+    static_assert(std::is_invocable_v<Func&, node_iterator*, node_iterator*>,
+                  "Func must be invocable with (iterator*, iterator*)");
+
+    ResumableAncestorsTraversal(node_iterator root, Func func)
+        : func_(std::move(func)), top_{root, 1}, node_{root}
+    {
+    }
+
+    /// Visits at most `budget` more nodes. Returns true if the traversal is finished.
+    /// Each call is counted as one traversal by the instrumentation of the traits.
+    bool resume(std::size_t budget)
+    {
+        typename Traits::Instrumentation::Probe probe;
+        for (; budget != 0 && !popFinished(); --budget) {
+            --top_.remaining;
+            detail::pushInstrumented(probe, ancestors_, node_);
+            probe.onNode();
+            Visit action = visit();
+            if (action == Visit::Stop) {
+                done_ = true;
+                return true;
+            }
+            std::size_t nb_children = Traits::getChildrenCount(node_);
+            if (nb_children == 0) {
+                ancestors_.pop_back();
+                ++node_;
+            }
+            else if (action == Visit::SkipSubtree) {
+                ancestors_.pop_back();
+                probe.onSiblingScan();
+                node_ = Traits::getNextSibling(node_);
+            }
+            else {
+                detail::pushInstrumented(probe, frames_, top_);
+                top_ = {node_, nb_children};
+                ++node_;
+            }
+        }
+        return popFinished();
+    }
+
+    /// Returns true if the traversal is finished.
+    bool done() const noexcept { return done_; }
+
+    /// Returns the next node to visit. Once finished, this is the iterator following the tree, or
+    /// the node on which `func` returned `Visit::Stop`.
+    node_iterator position() const noexcept { return node_; }
+
+    /// Returns the number of ancestors of the next node to visit.
+    std::size_t depth() const noexcept { return ancestors_.size(); }
+
+private:
+    // callbacks which do not return a Visit always continue
+    Visit visit()
+    {
+        node_iterator* first = ancestors_.data();
+        node_iterator* last = first + ancestors_.size();
+        if constexpr (std::is_same_v<std::invoke_result_t<Func&, node_iterator*, node_iterator*>,
+                                     Visit>)
+            return func_(first, last);
+        else {
+            func_(first, last);
+            return Visit::Continue;
+        }
+    }
+
+    // leaves the frames whose children are all visited, without calling `func`
+    bool popFinished() noexcept
+    {
+        while (!done_ && top_.remaining == 0) {
+            if (frames_.empty()) {
+                done_ = true;
+                break;
+            }
+            ancestors_.pop_back();
+            top_ = frames_.back();
+            frames_.pop_back();
+        }
+        return done_;
+    }
+
+    Func func_;
+    std::vector<node_iterator> ancestors_;
+    std::vector<detail::TraversalFrame<node_iterator>> frames_;
+    // starts as a virtual parent of the root: once it is back on top, the traversal is finished
+    detail::TraversalFrame<node_iterator> top_;
+    node_iterator node_;
+    bool done_ = false;
+};
+
+/// State of an `iterativeEvaluationTraversal` which runs in slices, see
+/// `NodeTraits::resumableEvaluationTraversal`. The values and the pending frames are stored in
+/// the object, so an evaluation can be suspended after any call of `func`, and resumed later.
+template <typename Traits, typename Value, typename Func>
+class ResumableEvaluationTraversal {
+public:
+    using node_iterator = typename Traits::iterator;
+
+    static_assert(std::is_invocable_r_v<Value, Func&, node_iterator, Value*, Value*>,
+                  "Func must match the signature (iterator, Value*, Value*) -> Value");
+
+    ResumableEvaluationTraversal(node_iterator root, Func func)
+        : func_(std::move(func)), top_{root, 1, 0}, node_{root}
+    {
+    }
+
+    /// Calls `func` at most `budget` more times. Returns true if the evaluation is finished.
+    /// Each call is counted as one traversal by the instrumentation of the traits.
+    bool resume(std::size_t budget)
+    {
+        typename Traits::Instrumentation::Probe probe;
+        while (budget != 0 && !finished()) {
+            if (top_.remaining == 0) {
+                probe.onNode();
+                auto ret = func_(top_.node, values_.data() + top_.first_value,
+                                 values_.data() + values_.size());
+                values_.resize(top_.first_value);
+                values_.emplace_back(std::move(ret));
+                top_ = frames_.back();
+                frames_.pop_back();
+                --budget;
+                continue;
+            }
+            --top_.remaining;
+            std::size_t nb_children = Traits::getChildrenCount(node_);
+            if (nb_children == 0) {
+                probe.onNode();
+                Value* end = values_.data() + values_.size();
+                auto ret = func_(node_, end, end);
+                detail::pushInstrumented(probe, values_, std::move(ret));
+                --budget;
+            }
+            else {
+                detail::pushInstrumented(probe, frames_, top_);
+                top_ = {node_, nb_children, values_.size()};
+            }
+            ++node_;
+        }
+        return finished();
+    }
+
+    /// Returns true if the evaluation is finished.
+    bool done() const noexcept { return finished(); }
+
+    /// Returns the value of the root, once finished.
+    Value& value() noexcept { return values_.front(); }
+
+    /// Returns the next node to visit, or the iterator following the tree once finished.
+    node_iterator position() const noexcept { return node_; }
+
+private:
+    // `top_` starts as a virtual parent of the root, which is back on top once it is evaluated
+    bool finished() const noexcept { return top_.remaining == 0 && frames_.empty(); }
+
+    Func func_;
+    std::vector<Value> values_;
+    std::vector<detail::EvaluationFrame<node_iterator>> frames_;
+    detail::EvaluationFrame<node_iterator> top_;
+    node_iterator node_;
+};
+
+/// Converts a pointer-based tree into a node sequence in preorder, in one pass without recursion.
+/// `children(node)` must be invocable with `root` and with the children, and must return
+/// a range of children which is valid until the end of the conversion (e.g. a reference to a
+/// member container).
+/// `make_node(node, std::size_t nb_children)` returns the element stored in the sequence.
+/// `size_hint` is the number of nodes reserved upfront.
+template <typename Root, typename ChildrenFunc, typename MakeNode>
+auto flatten(Root const& root,
+             ChildrenFunc&& children,
+             MakeNode&& make_node,
+             std::size_t size_hint = 0)
+{
+    using Node = std::decay_t<std::invoke_result_t<MakeNode&, Root const&, std::size_t>>;
+    using ChildIterator = decltype(std::begin(children(root)));
+
+    std::vector<Node> result;
+    result.reserve(size_hint);
+    std::vector<std::pair<ChildIterator, ChildIterator>> stack;
+
+    auto visit = [&](auto const& node) {
+        auto&& range = children(node);
+        ChildIterator first = std::begin(range), last = std::end(range);
+        result.push_back(make_node(node, static_cast<std::size_t>(std::distance(first, last))));
+        if (first != last)
+            stack.emplace_back(first, last);
+    };
+
+    visit(root);
+    while (!stack.empty()) {
+        auto& child = *stack.back().first;
+        if (++stack.back().first == stack.back().second)
+            stack.pop_back();
+        visit(child);
+    }
+    return result;
+}
+
+/// Tree lowered into a flat sequence of instructions in postorder, see `NodeTraits::compile`.
+/// Each instruction stores its payload, its number of children and the position of its children's
+/// values in the value stack, so evaluating the program needs no traversal logic.
+template <typename Payload>
+class PostfixProgram {
+public:
+    struct Instruction {
+        Payload payload;
+        std::uint32_t arity;  // number of children
+        std::uint32_t offset; // position of the first child's value, then of the node's value
+    };
+
+    PostfixProgram() = default;
+    PostfixProgram(std::vector<Instruction> instructions, std::size_t stack_size) noexcept
+        : instructions_{std::move(instructions)}, stack_size_{stack_size}
+    {
+    }
+
+    /// Returns the instructions, in postorder.
+    std::vector<Instruction> const& instructions() const noexcept { return instructions_; }
+
+    /// Returns the number of values needed to evaluate the program.
+    std::size_t stackSize() const noexcept { return stack_size_; }
+
+    /// Evaluates the program, `stack` must point to at least `stackSize()` values.
+    /// The program must not be empty: a default constructed `PostfixProgram` has no value.
+    /// Func must match the signature (Payload const&, Value* begin, Value* end) -> Value
+    template <typename Value, typename Func>
+    Value evaluate(Func&& func, Value* stack) const
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, Payload const&, Value*, Value*>,
+                      "Func must match the signature (Payload const&, Value*, Value*) -> Value");
+
+        for (Instruction const& instruction : instructions_) {
+            Value* children = stack + instruction.offset;
+            *children = func(instruction.payload, children, children + instruction.arity);
+        }
+        return std::move(stack[0]);
+    }
+
+    /// Same as above, allocating the value stack.
+    template <typename Value, typename Func>
+    Value evaluate(Func&& func) const
+    {
+        std::vector<Value> stack(stack_size_);
+        return evaluate<Value>(func, stack.data());
+    }
+
+private:
+    std::vector<Instruction> instructions_;
+    std::size_t stack_size_ = 0;
+};
+
 /// Provides functions to access nodes properties.
 /// Uses the CRTP pattern.
 /// Example of customization:
@@ -25,88 +1170,2671 @@ namespace jv {
 template <typename InputIterator, typename Crtp>
 struct NodeTraits {
     using iterator = InputIterator;
+    using value_type = typename std::iterator_traits<InputIterator>::value_type;
+
+    /// Returns the number of children this node has.
+    static constexpr std::size_t getChildrenCount(iterator node) noexcept = delete;
+
+    /// Maximum number of children of a node, or 0 if it is unbounded.
+    /// Traits may override it, for instance with 2 for binary expression trees: the child loops
+    /// are then unrolled, and `boundedEvaluationTraversal` becomes available.
+    /// This is a precondition on every node, not a hint: with 1 or 2, the unrolled traversals
+    /// skip the extra children of a node (checked by an assertion in debug builds).
+    static constexpr std::size_t maxChildren = 0;
+
+    /// Instrumentation policy of the traversals, `NoInstrumentation` by default.
+    /// Traits may override it, for instance with `CountingInstrumentation<Tag>`, to count the
+    /// nodes visited, the stack growth and the sibling scans of the traversals.
+    using Instrumentation = NoInstrumentation;
+
+    /// Iterates to the next sibling of the node.
+    static constexpr iterator getNextSibling(iterator node) noexcept
+    {
+        std::size_t remaining_nodes = 1;
+        do {
+            remaining_nodes = remaining_nodes + Crtp::getChildrenCount(node) - 1;
+            ++node;
+        } while (remaining_nodes > 0);
+        return node;
+    }
+
+    /// Base algorithm to recursively traverse the tree.
+    /// Example:
+    ///     void my_function(iterator root) {
+    ///         /* init */
+    ///         recursive_traversal(root, [&](iterator node, auto& self) {
+    ///             /* code to evaluate before node's children
+    ///             auto next_node = recursive_traversal(node, self);
+    ///             /* code to evaluate after node's children
+    ///             return next_node;
+    ///         });
+    ///     }
+    /// Returns an iterator to the end of the tree.
+    template <typename Func>
+    static iterator recursiveTraversal(iterator node, Func&& func)
+    {
+
+        std::size_t nb_children = Crtp::getChildrenCount(node);
+        ++node;
+        if constexpr (Crtp::maxChildren == 1 || Crtp::maxChildren == 2) {
+            assert(nb_children <= Crtp::maxChildren && "a node has more than maxChildren children");
+            if (nb_children != 0)
+                node = func(node, func);
+            if (Crtp::maxChildren == 2 && nb_children == 2)
+                node = func(node, func);
+        }
+        else {
+            for (; nb_children != 0; --nb_children) {
+                node = func(node, func);
+            }
+        }
+        return node;
+    }
+
+    /// Returns a range of the children of `node`, evaluated lazily.
+    /// Finding each child after the first uses `getNextSibling`, or `index` if provided.
+    static ChildrenView<Crtp> children(iterator node, SubtreeIndex<Crtp> const* index = nullptr)
+    {
+        return ChildrenView<Crtp>(node, index);
+    }
+
+    /// Returns a range of the nodes of the tree of `root` in preorder, including `root`.
+    /// It is single-pass if `iterator` is an input iterator.
+    static PreorderView<Crtp> preorder(iterator root) { return PreorderView<Crtp>(root); }
+
+    /// Returns a range of the leaves of the tree of `root`, in preorder.
+    /// It is single-pass if `iterator` is an input iterator.
+    static LeavesView<Crtp> leaves(iterator root) { return LeavesView<Crtp>(root); }
+
+    /// Returns a single-pass range of the nodes of the tree of `root` in postorder.
+    /// The range stores the nodes whose children are being visited, so its memory is
+    /// proportional to the depth of the tree.
+    static PostorderView<Crtp> postorder(iterator root) { return PostorderView<Crtp>(root); }
+
+    /// Returns a range of the ancestors of `node` in the tree of `root`, from `root` to `node`
+    /// included. Requires random-access iterators. Finding each ancestor scans the children of
+    /// the previous one, using `getNextSibling` or `index` if provided.
+    static AncestorsView<Crtp>
+    ancestors(iterator root, iterator node, SubtreeIndex<Crtp> const* index = nullptr)
+    {
+        return AncestorsView<Crtp>(root, node, index);
+    }
+
+    /// Returns an `iterativeAncestorsTraversal` of the tree of `root` which runs in slices: each
+    /// call of `resume(budget)` visits at most `budget` nodes, for instance to share a thread with
+    /// other tasks. `func` is stored in the returned object, and may return a `Visit`.
+    template <typename Func>
+    static ResumableAncestorsTraversal<Crtp, std::decay_t<Func>>
+    resumableAncestorsTraversal(iterator root, Func&& func)
+    {
+        return {root, std::forward<Func>(func)};
+    }
+
+    /// Returns an `iterativeEvaluationTraversal` of the tree of `root` which runs in slices: each
+    /// call of `resume(budget)` calls `func` at most `budget` times. Then, `value()` returns the
+    /// value of the root.
+    template <typename Value, typename Func>
+    static ResumableEvaluationTraversal<Crtp, Value, std::decay_t<Func>>
+    resumableEvaluationTraversal(iterator root, Func&& func)
+    {
+        return {root, std::forward<Func>(func)};
+    }
+
+    /// Buffers that can be reused between calls of the traversals.
+    template <typename T, typename Allocator = std::allocator<T>>
+    using Workspace = TraversalWorkspace<iterator, T, Allocator>;
+
+    /// Computes the parent and the children of each node of [begin, end), in one pass.
+    /// The sequence may contain several trees. This is the inverse of `jv::flatten`.
+    static TreeLinks unflatten(iterator begin, iterator end)
+    {
+        TreeLinks links;
+        if constexpr (detail::is_random_access_v<iterator>) {
+            links.parents.reserve(end - begin);
+            links.child_offsets.reserve(end - begin + 1);
+        }
+        links.child_offsets.push_back(0);
+
+        std::vector<detail::TraversalFrame<std::size_t>> stack; // parents with pending children
+        for (std::size_t i = 0; begin != end; ++begin, ++i) {
+            while (!stack.empty() && stack.back().remaining == 0)
+                stack.pop_back();
+            if (stack.empty()) {
+                links.parents.push_back(TreeLinks::npos);
+            }
+            else {
+                std::size_t parent = stack.back().node;
+                std::size_t nb_children =
+                    links.child_offsets[parent + 1] - links.child_offsets[parent];
+                links.children[links.child_offsets[parent] + nb_children - stack.back().remaining] =
+                    i;
+                --stack.back().remaining;
+                links.parents.push_back(parent);
+            }
+
+            std::size_t nb_children = Crtp::getChildrenCount(begin);
+            links.child_offsets.push_back(links.child_offsets.back() + nb_children);
+            links.children.resize(links.child_offsets.back());
+            if (nb_children != 0)
+                stack.push_back({i, nb_children});
+        }
+        return links;
+    }
+
+    /// Returns the depth of the tree, which is 1 if `root` has no children.
+    static std::size_t getDepth(iterator root)
+    {
+        std::size_t depth = 1;
+        std::vector<std::size_t> stack; // children left to visit for each ancestor of `top`
+        std::size_t top = Crtp::getChildrenCount(root);
+
+        iterator node = root;
+        ++node;
+        while (true) {
+            while (top == 0) {
+                if (stack.empty())
+                    return depth;
+                top = stack.back();
+                stack.pop_back();
+            }
+            --top;
+            // the depth of `node` is the number of its ancestors, plus one
+            depth = std::max(depth, stack.size() + 2);
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children != 0) {
+                stack.push_back(top);
+                top = nb_children;
+            }
+            ++node;
+        }
+    }
+
+    /// Stores parent nodes (ancestors) and evaluates the given function.
+    /// The function must be invocable with (iterator* begin, iterator* end)
+    /// If it returns a `Visit`, the subtree of the last ancestor is skipped on
+    /// `Visit::SkipSubtree`, and the traversal ends on `Visit::Stop`: the returned iterator is
+    /// then the last ancestor, instead of the end of the tree.
+    template <typename Allocator = std::allocator<iterator>, typename Func>
+    static iterator ancestorsTraversal(iterator root, Func&& func, Allocator alloc = {})
+    {
+        Workspace<iterator, Allocator> workspace(alloc);
+        return ancestorsTraversal(root, func, workspace);
+    }
+
+    /// Same as above, using the buffers of `workspace`.
+    template <typename Allocator, typename Func>
+    static iterator
+    ancestorsTraversal(iterator root, Func&& func, Workspace<iterator, Allocator>& workspace)
+    {
+        static_assert(std::is_invocable_v<Func, iterator*, iterator*>,
+                      "Func must be invocable with (iterator*, iterator*)");
+
+        // pruning requires to stop in the middle of the tree, which the recursion cannot do
+        if constexpr (std::is_same_v<std::invoke_result_t<Func&, iterator*, iterator*>, Visit>)
+            return iterativeAncestorsTraversal(root, func, workspace);
+        else {
+            typename Crtp::Instrumentation::Probe probe;
+            auto& ancestors = workspace.stack;
+            ancestors.clear();
+            detail::pushInstrumented(probe, ancestors, root);
+            probe.onNode();
+            func(ancestors.data(), ancestors.data() + ancestors.size());
+
+            return recursiveTraversal(root, [&](iterator node, auto& self) {
+                detail::pushInstrumented(probe, ancestors, node);
+                probe.onNode();
+                func(ancestors.data(), ancestors.data() + ancestors.size());
+                auto next = recursiveTraversal(node, self);
+                ancestors.pop_back();
+                return next;
+            });
+        }
+    }
+
+    /// Computes a value for each node from the value of its parent, from the root to the leaves.
+    /// This is the top-down counterpart of `evaluationTraversal`: the value of the root is
+    /// computed from `init`, and only the values of the ancestors of the current node are stored.
+    /// Func must match the signature (iterator node, Down const& parent_value) -> Down
+    /// Returns the iterator following the tree.
+    template <typename Down, typename Allocator = std::allocator<Down>, typename Func>
+    static iterator
+    propagationTraversal(iterator root, Down const& init, Func&& func, Allocator alloc = {})
+    {
+        Workspace<Down, Allocator> workspace(alloc);
+        return propagationTraversal(root, init, func, workspace);
+    }
+
+    /// Same as above, using the buffers of `workspace`.
+    template <typename Down, typename Allocator, typename Func>
+    static iterator propagationTraversal(iterator root,
+                                         Down const& init,
+                                         Func&& func,
+                                         Workspace<Down, Allocator>& workspace)
+    {
+        static_assert(std::is_invocable_r_v<Down, Func, iterator, Down const&>,
+                      "Func must match the signature (iterator, Down const&) -> Down");
+
+        typename Crtp::Instrumentation::Probe probe;
+        auto& values = workspace.stack;
+        auto& frames = workspace.frames;
+        values.clear();
+        frames.clear();
+
+        // the innermost frame is kept out of the stack, and the values of leaves are not stored
+        typename Workspace<Down, Allocator>::Frame top{root, Crtp::getChildrenCount(root), 0};
+        probe.onNode();
+        Down value = func(root, init);
+        iterator node = root;
+        ++node;
+        if (top.remaining == 0)
+            return node;
+        detail::pushInstrumented(probe, values, std::move(value));
+        while (true) {
+            while (top.remaining == 0) {
+                values.pop_back();
+                if (frames.empty())
+                    return node;
+                top = frames.back();
+                frames.pop_back();
+            }
+            --top.remaining;
+            probe.onNode();
+            Down child_value = func(node, values.back());
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children != 0) {
+                detail::pushInstrumented(probe, frames, top);
+                top = {node, nb_children, 0};
+                detail::pushInstrumented(probe, values, std::move(child_value));
+            }
+            ++node;
+        }
+    }
+
+    /// For each node, we evaluate the given function by passing the result of evaluation of its children.
+    /// Func must match the signature (iterator node, Value* begin, Value* end) -> Value
+    template <typename Value, typename Allocator = std::allocator<Value>, typename Func>
+    static std::pair<Value, iterator>
+    evaluationTraversal(iterator root, Func&& func, Allocator alloc = {})
+    {
+        Workspace<Value, Allocator> workspace(alloc);
+        return evaluationTraversal<Value>(root, func, workspace);
+    }
+
+    /// Same as above, using the buffers of `workspace`.
+    template <typename Value, typename Allocator, typename Func>
+    static std::pair<Value, iterator>
+    evaluationTraversal(iterator root, Func&& func, Workspace<Value, Allocator>& workspace)
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
+                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+
+        typename Crtp::Instrumentation::Probe probe;
+        auto& values = workspace.stack;
+        values.clear();
+
+        auto next = recursiveTraversal(root, [&](iterator node, auto& self) {
+            std::size_t begin_index = values.size();
+            auto next = recursiveTraversal(node, self);
+            probe.onNode();
+            auto ret = func(node, values.data() + begin_index, values.data() + values.size());
+            values.resize(begin_index);
+            detail::pushInstrumented(probe, values, std::move(ret));
+            return next;
+        });
+
+        probe.onNode();
+        return {func(root, values.data(), values.data() + values.size()), next};
+    }
+
+    /// Same as `evaluationTraversal`, but the value of each node is constructed in place, for heavy
+    /// Value types such as strings or containers.
+    /// Func must be invocable with (iterator node, Value* begin, Value* end, Value& result), and
+    /// must assign the value of `node` to `result`. The values of the children may be moved from.
+    /// `result` is a slot reused from a previous node, whose value is unspecified: assigning it
+    /// (e.g. `result.clear()` then appending) reuses its capacity instead of allocating.
+    /// The slots are kept in the workspace between calls. Reserving the workspace for the depth
+    /// of the tree avoids reallocating them, which copies values if their move is not noexcept.
+    template <typename Value, typename Allocator = std::allocator<Value>, typename Func>
+    static std::pair<Value, iterator>
+    inplaceEvaluationTraversal(iterator root, Func&& func, Allocator alloc = {})
+    {
+        Workspace<Value, Allocator> workspace(alloc);
+        return inplaceEvaluationTraversal<Value>(root, func, workspace);
+    }
+
+    /// Same as above, using the buffers of `workspace`.
+    template <typename Value, typename Allocator, typename Func>
+    static std::pair<Value, iterator>
+    inplaceEvaluationTraversal(iterator root, Func&& func, Workspace<Value, Allocator>& workspace)
+    {
+        static_assert(std::is_invocable_v<Func, iterator, Value*, Value*, Value&>,
+                      "Func must be invocable with (iterator, Value*, Value*, Value&)");
+        static_assert(std::is_default_constructible_v<Value>,
+                      "inplaceEvaluationTraversal requires a default constructible Value");
+
+        using Frame = detail::EvaluationFrame<iterator>;
+        typename Crtp::Instrumentation::Probe probe;
+        auto& slots = workspace.stack; // the slots past `nb_values` are spare
+        auto& stack = workspace.frames;
+        stack.clear();
+        std::size_t nb_values = 0;
+
+        // evaluates `node` in the first spare slot, then swaps it with the first child's value,
+        // which becomes spare
+        auto evaluate = [&](iterator node, std::size_t first_value) {
+            if (nb_values == slots.size())
+                detail::pushInstrumented(probe, slots);
+            Value* first = slots.data() + first_value;
+            Value* result = slots.data() + nb_values;
+            probe.onNode();
+            func(node, first, result, *result);
+            if (first != result) {
+                using std::swap;
+                swap(*first, *result);
+            }
+            nb_values = first_value + 1;
+        };
+
+        // the innermost frame is kept out of the stack, and leaves never enter it
+        Frame top{root, Crtp::getChildrenCount(root), 0};
+        iterator node = root;
+        ++node;
+        while (true) {
+            while (top.remaining == 0) {
+                evaluate(top.node, top.first_value);
+                if (stack.empty())
+                    return {std::move(slots[0]), node};
+                top = stack.back();
+                stack.pop_back();
+            }
+            --top.remaining;
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children == 0) {
+                evaluate(node, nb_values);
+            }
+            else {
+                detail::pushInstrumented(probe, stack, top);
+                top = {node, nb_children, nb_values};
+            }
+            ++node;
+        }
+    }
+
+    /// Same as `evaluationTraversal` for trees of depth at most `MaxDepth`, without any heap
+    /// allocation: the values are stored in a `std::array` sized from `maxChildren`, which the
+    /// traits must define. Slots are reused by assignment, so Value must be default constructible.
+    /// Throws std::length_error if the tree is deeper than `MaxDepth`, or if a node has more
+    /// than `maxChildren` children.
+    template <typename Value, std::size_t MaxDepth, typename Func>
+    static std::pair<Value, iterator> boundedEvaluationTraversal(iterator root, Func&& func)
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
+                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+        static_assert(Crtp::maxChildren != 0,
+                      "boundedEvaluationTraversal requires the traits to define maxChildren");
+        static_assert(MaxDepth != 0, "MaxDepth must be at least 1");
+        static_assert(std::is_default_constructible_v<Value>,
+                      "boundedEvaluationTraversal requires a default constructible Value");
+
+        // each ancestor of the current node holds at most `maxChildren - 1` values of children
+        // already evaluated, and the deepest one holds at most `maxChildren` values
+        constexpr std::size_t max_values = (MaxDepth - 1) * (Crtp::maxChildren - 1) + 1;
+        using Frame = detail::EvaluationFrame<iterator>;
+        typename Crtp::Instrumentation::Probe probe;
+        std::array<Value, max_values> values;
+        std::array<Frame, MaxDepth> stack;
+        std::size_t nb_values = 0, nb_frames = 0;
+
+        // `depth` is the depth of `node`, whose children must not be deeper than MaxDepth
+        auto children_count = [](iterator node, std::size_t depth) {
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children > Crtp::maxChildren)
+                throw std::length_error("boundedEvaluationTraversal: too many children");
+            if (nb_children != 0 && depth >= MaxDepth)
+                throw std::length_error("boundedEvaluationTraversal: tree is too deep");
+            return nb_children;
+        };
+
+        // the innermost frame is kept out of the stack, and leaves never enter it
+        Frame top{root, children_count(root, 1), 0};
+        iterator node = root;
+        ++node;
+        while (true) {
+            while (top.remaining == 0) {
+                probe.onNode();
+                values[top.first_value] = func(top.node, values.data() + top.first_value,
+                                               values.data() + nb_values);
+                nb_values = top.first_value + 1;
+                if (nb_frames == 0)
+                    return {std::move(values[0]), node};
+                top = stack[--nb_frames];
+            }
+            --top.remaining;
+            // `top` and the stacked frames are the ancestors of `node`
+            std::size_t nb_children = children_count(node, nb_frames + 2);
+            if (nb_children == 0) {
+                probe.onNode();
+                Value* end = values.data() + nb_values;
+                values[nb_values] = func(node, end, end);
+                probe.onStackDepth(++nb_values);
+            }
+            else {
+                stack[nb_frames++] = top;
+                probe.onStackDepth(nb_frames);
+                top = {node, nb_children, nb_values};
+            }
+            ++node;
+        }
+    }
+
+    /// Same as `evaluationTraversal`, but the subtrees below the top levels of the tree are
+    /// evaluated concurrently by `executor`, then their values are combined in order.
+    /// The top levels are split until there are at least `min_tasks` subtrees
+    /// (by default, 4 per hardware thread).
+    /// The result is identical to `evaluationTraversal`, but `func` must be thread-safe.
+    /// Locating the subtrees requires scanning them with `getNextSibling`: use the overload
+    /// taking a `SubtreeIndex` for large trees.
+    template <typename Value, typename Executor = ThreadExecutor, typename Func>
+    static std::pair<Value, iterator>
+    parallelEvaluationTraversal(iterator root,
+                                Func&& func,
+                                Executor executor = {},
+                                std::size_t min_tasks = 0)
+    {
+        return parallelEvaluation<Value>(
+            root, func, [](iterator node) { return Crtp::getNextSibling(node); }, executor,
+            min_tasks);
+    }
+
+    /// Same as `parallelEvaluationTraversal`, using `index` to find where subtrees start.
+    template <typename Value, typename Executor = ThreadExecutor, typename Func>
+    static std::pair<Value, iterator>
+    parallelEvaluationTraversal(iterator root,
+                                Func&& func,
+                                SubtreeIndex<Crtp> const& index,
+                                Executor executor = {},
+                                std::size_t min_tasks = 0)
+    {
+        return parallelEvaluation<Value>(
+            root, func, [&](iterator node) { return index.getNextSibling(node); }, executor,
+            min_tasks);
+    }
+
+    /// Evaluates each tree of the sequence [begin, end), which contains trees back to back, and
+    /// writes the value of each root in `out`. The buffers are shared by all the trees.
+    /// Func must match the signature (iterator node, Value* begin, Value* end) -> Value
+    /// Returns the output iterator past the last value.
+    template <typename Value,
+              typename Allocator = std::allocator<Value>,
+              typename Func,
+              typename OutputIterator>
+    static OutputIterator forestEvaluationTraversal(
+        iterator begin, iterator end, Func&& func, OutputIterator out, Allocator alloc = {})
+    {
+        Workspace<Value, Allocator> workspace(alloc);
+        return forestEvaluationTraversal<Value>(begin, end, func, out, workspace);
+    }
+
+    /// Same as above, using the buffers of `workspace`.
+    template <typename Value, typename Allocator, typename Func, typename OutputIterator>
+    static OutputIterator forestEvaluationTraversal(iterator begin,
+                                                    iterator end,
+                                                    Func&& func,
+                                                    OutputIterator out,
+                                                    Workspace<Value, Allocator>& workspace)
+    {
+        while (begin != end) {
+            auto [value, next] = iterativeEvaluationTraversal<Value>(begin, func, workspace);
+            *out = std::move(value);
+            ++out;
+            begin = next;
+        }
+        return out;
+    }
+
+    /// Same as `forestEvaluationTraversal`, but the trees are evaluated concurrently by `executor`.
+    /// The roots are found first with `getNextSibling`, then the trees are split into `min_tasks`
+    /// chunks having about the same number of nodes (by default, 4 chunks per hardware thread).
+    /// Requires random-access iterators, and `func` must be thread-safe.
+    template <typename Value,
+              typename Executor = ThreadExecutor,
+              typename Func,
+              typename OutputIterator>
+    static OutputIterator parallelForestEvaluationTraversal(iterator begin,
+                                                            iterator end,
+                                                            Func&& func,
+                                                            OutputIterator out,
+                                                            Executor executor = {},
+                                                            std::size_t min_tasks = 0)
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
+                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+        static_assert(detail::is_random_access_v<iterator>,
+                      "parallelForestEvaluationTraversal requires random-access iterators");
+
+        if (min_tasks == 0)
+            min_tasks = 4 * std::max(std::thread::hardware_concurrency(), 1u);
+
+        std::vector<iterator> roots;
+        for (iterator root = begin; root != end; root = Crtp::getNextSibling(root))
+            roots.push_back(root);
+
+        // chunk `i` contains the trees from roots[chunks[i]] to roots[chunks[i+1]] (excluded)
+        std::size_t nb_nodes = end - begin;
+        std::size_t chunk_size = std::max<std::size_t>(nb_nodes / min_tasks, 1);
+        std::vector<std::size_t> chunks{0};
+        for (std::size_t i = 1; i < roots.size(); ++i)
+            if (std::size_t(roots[i] - roots[chunks.back()]) >= chunk_size)
+                chunks.push_back(i);
+        chunks.push_back(roots.size());
+
+        std::vector<std::optional<Value>> results(roots.size());
+        executor(chunks.size() - 1, [&](std::size_t chunk) {
+            Workspace<Value> workspace;
+            for (std::size_t i = chunks[chunk]; i != chunks[chunk + 1]; ++i)
+                results[i].emplace(
+                    iterativeEvaluationTraversal<Value>(roots[i], func, workspace).first);
+        });
+
+        for (auto& result : results) {
+            *out = std::move(*result);
+            ++out;
+        }
+        return out;
+    }
+
+    /// Computes a 64-bit hash of the tree of `root`, in the same bottom-up pass as
+    /// `iterativeEvaluationTraversal`: the hash of each subtree combines the hash of its root, its
+    /// number of children and the hashes of its children, so equal subtrees have equal hashes
+    /// wherever they are. See `SubtreeDag` to identify equal subtrees exactly.
+    /// NodeHash must match the signature (iterator node) -> std::uint64_t, hashing the node alone.
+    /// Returns the hash of the root and the iterator following the tree.
+    template <typename Allocator = std::allocator<std::uint64_t>, typename NodeHash>
+    static std::pair<std::uint64_t, iterator>
+    hashTraversal(iterator root, NodeHash&& node_hash, Allocator alloc = {})
+    {
+        static_assert(std::is_invocable_r_v<std::uint64_t, NodeHash, iterator>,
+                      "NodeHash must match the signature (iterator) -> std::uint64_t");
+
+        auto hash = [&](iterator node, std::uint64_t* it, std::uint64_t* end) {
+            std::uint64_t result = hashCombine(node_hash(node), end - it);
+            for (; it != end; ++it)
+                result = hashCombine(result, *it);
+            return result;
+        };
+        return iterativeEvaluationTraversal<std::uint64_t>(root, hash, alloc);
+    }
+
+    /// Writes a rewritten copy of the tree of `root` in preorder at the end of `out`, in one pass.
+    /// For each node of the input, `func` returns a `Transform` telling what becomes of it: kept
+    /// with a new payload, replaced by a leaf or by a copy of other trees, removed with its
+    /// subtree, or spliced (its children take its place among its siblings). The children counts
+    /// of the written nodes are fixed when their children are done, so `out` may receive zero or
+    /// several trees. `size_hint` is the number of nodes reserved in `out`: by default, the size
+    /// of the input tree if the iterators are random access.
+    /// Func must match the signature (iterator node) -> Transform<Payload, Arity>
+    /// Throws std::overflow_error if a written node has too many children for `Arity`.
+    /// Returns the iterator following the input tree.
+    template <typename Payload,
+              typename Arity,
+              typename Allocator = std::allocator<std::size_t>,
+              typename Func>
+    static iterator transformTraversal(iterator root,
+                                       Func&& func,
+                                       FlatTree<Payload, Arity>& out,
+                                       std::size_t size_hint = 0,
+                                       Allocator alloc = {})
+    {
+        using Action = Transform<Payload, Arity>;
+        static_assert(std::is_invocable_r_v<Action, Func, iterator>,
+                      "Func must match the signature (iterator) -> Transform<Payload, Arity>");
+
+        // a node of the input whose children are not all transformed: `out_node` is its position
+        // in `out`, or npos if it is spliced, and it has `nb_children` children in `out` so far
+        struct Frame {
+            std::size_t remaining;
+            std::size_t out_node;
+            std::size_t nb_children;
+        };
+        constexpr std::size_t npos = std::numeric_limits<std::size_t>::max();
+
+        if constexpr (detail::is_random_access_v<iterator>) {
+            if (size_hint == 0)
+                size_hint = static_cast<std::size_t>(Crtp::getNextSibling(root) - root);
+        }
+        // grows geometrically, so that appending many trees to `out` stays linear
+        std::size_t required = out.size() + size_hint;
+        if (out.capacity() < required)
+            out.reserve(std::max(required, 2 * out.capacity()));
+
+        // `top` starts as a virtual spliced parent of the root
+        std::vector<Frame, detail::RebindAlloc<Allocator, Frame>> stack(alloc);
+        Frame top{1, npos, 0};
+        iterator node = root;
+        while (true) {
+            while (top.remaining == 0) {
+                if (stack.empty())
+                    return node;
+                Frame child = top;
+                top = stack.back();
+                stack.pop_back();
+                if (child.out_node == npos)
+                    top.nb_children += child.nb_children;
+                else
+                    out.setArity(child.out_node, child.nb_children);
+            }
+            --top.remaining;
+            Action action = func(node);
+            switch (action.kind()) {
+            case Action::Kind::Keep:
+            case Action::Kind::Splice: {
+                std::size_t nb_children = Crtp::getChildrenCount(node);
+                std::size_t out_node = npos;
+                if (action.kind() == Action::Kind::Keep) {
+                    out_node = out.size();
+                    out.push_back(std::move(action.payload()), 0);
+                    ++top.nb_children;
+                }
+                ++node;
+                if (nb_children != 0) {
+                    stack.push_back(top);
+                    top = {nb_children, out_node, 0};
+                }
+                break;
+            }
+            case Action::Kind::Leaf:
+                out.push_back(std::move(action.payload()), 0);
+                ++top.nb_children;
+                node = Crtp::getNextSibling(node);
+                break;
+            case Action::Kind::Insert: {
+                auto forest = action.forest();
+                std::size_t pending = 0;
+                for (std::size_t i = 0; i != forest.size(); ++i) {
+                    if (pending == 0)
+                        ++top.nb_children;
+                    else
+                        --pending;
+                    pending += forest.arities()[i];
+                    out.push_back(forest.payload(i), forest.arities()[i]);
+                }
+                node = Crtp::getNextSibling(node);
+                break;
+            }
+            case Action::Kind::Remove:
+                node = Crtp::getNextSibling(node);
+                break;
+            }
+        }
+    }
+
+    /// Lowers the tree into a `PostfixProgram`, to evaluate it repeatedly without traversing it.
+    /// `lower` converts each node to the payload of its instruction, by default the node itself.
+    /// Throws std::length_error if the value stack needs more than 2^32-1 values.
+    /// Returns the program and an iterator to the end of the tree.
+    template <typename Lower>
+    static auto compile(iterator root, Lower&& lower)
+    {
+        using Program = PostfixProgram<std::decay_t<std::invoke_result_t<Lower&, iterator>>>;
+        using Frame = detail::EvaluationFrame<iterator>;
+        std::vector<typename Program::Instruction> instructions;
+        std::vector<Frame> stack;
+        std::size_t nb_values = 0, stack_size = 0;
+
+        iterator node = root;
+        while (true) {
+            stack.push_back({node, Crtp::getChildrenCount(node), nb_values});
+            ++node;
+            while (stack.back().remaining == 0) {
+                Frame& frame = stack.back();
+                // the arity and the offset are at most `nb_values`
+                if (nb_values > std::numeric_limits<std::uint32_t>::max())
+                    throw std::length_error("compile: too many values");
+                instructions.push_back({lower(frame.node),
+                                        static_cast<std::uint32_t>(nb_values - frame.first_value),
+                                        static_cast<std::uint32_t>(frame.first_value)});
+                nb_values = frame.first_value + 1;
+                stack_size = std::max(stack_size, nb_values);
+                stack.pop_back();
+                if (stack.empty())
+                    return std::pair{Program(std::move(instructions), stack_size), node};
+            }
+            --stack.back().remaining;
+        }
+    }
+
+    static std::pair<PostfixProgram<iterator>, iterator> compile(iterator root)
+    {
+        return compile(root, [](iterator node) { return node; });
+    }
+
+    /// Evaluates the tree for `nb_inputs` inputs, `N` inputs at a time, and writes the results in
+    /// `out`. The tree is compiled once, so the traversal overhead is paid once for all inputs.
+    /// Func must match the signature
+    ///     (iterator node, std::size_t first_input, Lanes<T, N>* begin, Lanes<T, N>* end)
+    ///         -> Lanes<T, N>
+    /// where lane `i` corresponds to the input `first_input + i`. In the last batch, the lanes
+    /// past `nb_inputs` are computed but ignored.
+    /// Returns the output iterator past the last result and an iterator to the end of the tree.
+    template <typename T, std::size_t N, typename Func, typename OutputIterator>
+    static std::pair<OutputIterator, iterator>
+    batchEvaluationTraversal(iterator root, std::size_t nb_inputs, Func&& func, OutputIterator out)
+    {
+        using Pack = Lanes<T, N>;
+        static_assert(std::is_invocable_r_v<Pack, Func, iterator, std::size_t, Pack*, Pack*>,
+                      "Func must match the signature "
+                      "(iterator, std::size_t, Lanes<T, N>*, Lanes<T, N>*) -> Lanes<T, N>");
+
+        auto [program, next] = compile(root);
+        std::vector<Pack> stack(program.stackSize());
+        for (std::size_t first_input = 0; first_input < nb_inputs; first_input += N) {
+            Pack pack = program.template evaluate<Pack>(
+                [&](iterator node, Pack* begin, Pack* end) {
+                    return func(node, first_input, begin, end);
+                },
+                stack.data());
+            std::size_t nb_lanes = std::min(N, nb_inputs - first_input);
+            out = std::copy(pack.lanes, pack.lanes + nb_lanes, out);
+        }
+        return {out, next};
+    }
+
+    /// Iterative equivalent of `recursiveTraversal`, using an explicit stack instead of recursion.
+    /// `pre` is called with each node before its children, and `post` after its children.
+    /// Unlike `recursiveTraversal`, `root` itself is also visited.
+    /// Returns an iterator to the end of the tree.
+    template <typename Allocator = std::allocator<iterator>, typename PreFunc, typename PostFunc>
+    static iterator
+    iterativeTraversal(iterator root, PreFunc&& pre, PostFunc&& post, Allocator alloc = {})
+    {
+        static_assert(std::is_invocable_v<PreFunc, iterator>,
+                      "PreFunc must be invocable with (iterator)");
+        static_assert(std::is_invocable_v<PostFunc, iterator>,
+                      "PostFunc must be invocable with (iterator)");
+
+        using Frame = detail::TraversalFrame<iterator>;
+        typename Crtp::Instrumentation::Probe probe;
+        std::vector<Frame, detail::RebindAlloc<Allocator, Frame>> stack(alloc);
+
+        // the innermost frame is kept out of the stack, and leaves never enter it
+        probe.onNode();
+        pre(root);
+        Frame top{root, Crtp::getChildrenCount(root)};
+        iterator node = root;
+        ++node;
+        while (true) {
+            while (top.remaining == 0) {
+                post(top.node);
+                if (stack.empty())
+                    return node;
+                top = stack.back();
+                stack.pop_back();
+            }
+            --top.remaining;
+            probe.onNode();
+            pre(node);
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children == 0) {
+                post(node);
+            }
+            else {
+                detail::pushInstrumented(probe, stack, top);
+                top = {node, nb_children};
+            }
+            ++node;
+        }
+    }
+
+    /// Same as `ancestorsTraversal`, for single-pass input iterators such as `istream_iterator`:
+    /// the tree is consumed once, and the ancestors are stored as copies of the nodes, so the
+    /// memory is proportional to the depth of the tree.
+    /// The function must be invocable with (value_type const* begin, value_type const* end)
+    /// Returns the iterator following the tree.
+    template <typename Allocator = std::allocator<value_type>, typename Func>
+    static iterator streamAncestorsTraversal(iterator root, Func&& func, Allocator alloc = {})
+    {
+        using Node = value_type;
+        static_assert(std::is_invocable_v<Func, Node const*, Node const*>,
+                      "Func must be invocable with (value_type const*, value_type const*)");
+
+        std::vector<Node, detail::RebindAlloc<Allocator, Node>> ancestors(alloc);
+        // children left to visit for each ancestor, leaves are never stacked
+        std::vector<std::size_t, detail::RebindAlloc<Allocator, std::size_t>> remaining(alloc);
+        typename Crtp::Instrumentation::Probe probe;
+
+        iterator node = root;
+        while (true) {
+            detail::pushInstrumented(probe, ancestors, *node);
+            probe.onNode();
+            Node const* first = ancestors.data();
+            func(first, first + ancestors.size());
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            ++node;
+            if (nb_children == 0)
+                ancestors.pop_back();
+            else
+                detail::pushInstrumented(probe, remaining, nb_children);
+
+            while (remaining.empty() || remaining.back() == 0) {
+                if (remaining.empty())
+                    return node;
+                ancestors.pop_back();
+                remaining.pop_back();
+            }
+            --remaining.back();
+        }
+    }
+
+    /// Same as `evaluationTraversal`, for single-pass input iterators such as `istream_iterator`:
+    /// the tree is consumed once, and the nodes waiting for their children's values are stored
+    /// as copies, so the memory is proportional to the depth of the tree.
+    /// Func must match the signature (value_type const& node, Value* begin, Value* end) -> Value
+    /// Returns the value of the root and the iterator following the tree.
+    template <typename Value, typename Allocator = std::allocator<Value>, typename Func>
+    static std::pair<Value, iterator>
+    streamEvaluationTraversal(iterator root, Func&& func, Allocator alloc = {})
+    {
+        using Node = value_type;
+        static_assert(std::is_invocable_r_v<Value, Func, Node const&, Value*, Value*>,
+                      "Func must match the signature (value_type const&, Value*, Value*) -> Value");
+
+        struct Frame {
+            Node node;
+            std::size_t remaining;
+            std::size_t first_value;
+        };
+        std::vector<Value, Allocator> values(alloc);
+        std::vector<Frame, detail::RebindAlloc<Allocator, Frame>> frames(alloc); // only inner nodes
+        typename Crtp::Instrumentation::Probe probe;
+
+        iterator node = root;
+        while (true) {
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children == 0) {
+                probe.onNode();
+                Value* end = values.data() + values.size();
+                auto ret = func(*node, end, end);
+                detail::pushInstrumented(probe, values, std::move(ret));
+            }
+            else {
+                detail::pushInstrumented(probe, frames, Frame{*node, nb_children, values.size()});
+            }
+            ++node;
+
+            while (frames.empty() || frames.back().remaining == 0) {
+                if (frames.empty())
+                    return {std::move(values.back()), node};
+                Frame& frame = frames.back();
+                probe.onNode();
+                auto ret = func(std::as_const(frame.node), values.data() + frame.first_value,
+                                values.data() + values.size());
+                values.resize(frame.first_value);
+                values.emplace_back(std::move(ret));
+                frames.pop_back();
+            }
+            --frames.back().remaining;
+        }
+    }
+
+    /// Calls `func(iterator node)` for each node in preorder, including `root`, until it returns
+    /// `Visit::Stop`. The subtree of a node is skipped if `func` returns `Visit::SkipSubtree`.
+    /// Returns the node on which `func` returned `Visit::Stop`, or an iterator to the end of the
+    /// tree. Skipping subtrees uses `getNextSibling`: use the overload taking a `SubtreeIndex`
+    /// to skip large subtrees in constant time.
+    template <typename Func>
+    static iterator visitTraversal(iterator root, Func&& func)
+    {
+        return visit(root, func, [](iterator node) { return Crtp::getNextSibling(node); });
+    }
+
+    /// Same as above, using `index` to skip subtrees.
+    template <typename Func>
+    static iterator visitTraversal(iterator root, Func&& func, SubtreeIndex<Crtp> const& index)
+    {
+        return visit(root, func, [&](iterator node) { return index.getNextSibling(node); });
+    }
+
+    /// Same as `ancestorsTraversal`, but uses an explicit stack instead of the call stack.
+    /// Suitable for very deep trees. `func` may also return a `Visit` to prune the traversal.
+    template <typename Allocator = std::allocator<iterator>, typename Func>
+    static iterator iterativeAncestorsTraversal(iterator root, Func&& func, Allocator alloc = {})
+    {
+        Workspace<iterator, Allocator> workspace(alloc);
+        return iterativeAncestorsTraversal(root, func, workspace);
+    }
+
+    /// Same as above, using the buffers of `workspace`.
+    template <typename Allocator, typename Func>
+    static iterator iterativeAncestorsTraversal(iterator root,
+                                                Func&& func,
+                                                Workspace<iterator, Allocator>& workspace)
+    {
+        static_assert(std::is_invocable_v<Func, iterator*, iterator*>,
+                      "Func must be invocable with (iterator*, iterator*)");
+
+        typename Crtp::Instrumentation::Probe probe;
+        auto& ancestors = workspace.stack;
+        auto& frames = workspace.frames;
+        ancestors.clear();
+        frames.clear();
+
+        // callbacks which do not return a Visit always continue
+        auto visit = [&] {
+            probe.onNode();
+            if constexpr (std::is_same_v<std::invoke_result_t<Func&, iterator*, iterator*>, Visit>)
+                return func(ancestors.data(), ancestors.data() + ancestors.size());
+            else {
+                func(ancestors.data(), ancestors.data() + ancestors.size());
+                return Visit::Continue;
+            }
+        };
+
+        // the innermost frame is kept out of the stack, and leaves never enter it
+        detail::pushInstrumented(probe, ancestors, root);
+        switch (visit()) {
+        case Visit::Continue: break;
+        case Visit::SkipSubtree: probe.onSiblingScan(); return Crtp::getNextSibling(root);
+        case Visit::Stop: return root;
+        }
+        typename Workspace<iterator, Allocator>::Frame top{root, Crtp::getChildrenCount(root), 0};
+        iterator node = root;
+        ++node;
+        while (true) {
+            while (top.remaining == 0) {
+                ancestors.pop_back();
+                if (frames.empty())
+                    return node;
+                top = frames.back();
+                frames.pop_back();
+            }
+            --top.remaining;
+            detail::pushInstrumented(probe, ancestors, node);
+            Visit action = visit();
+            if (action == Visit::Stop)
+                return node;
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children == 0) {
+                ancestors.pop_back();
+                ++node;
+            }
+            else if (action == Visit::SkipSubtree) {
+                ancestors.pop_back();
+                probe.onSiblingScan();
+                node = Crtp::getNextSibling(node);
+            }
+            else {
+                detail::pushInstrumented(probe, frames, top);
+                top = {node, nb_children, 0};
+                ++node;
+            }
+        }
+    }
+
+    /// Same as `evaluationTraversal`, but uses an explicit stack instead of the call stack.
+    /// Suitable for very deep trees.
+    template <typename Value, typename Allocator = std::allocator<Value>, typename Func>
+    static std::pair<Value, iterator>
+    iterativeEvaluationTraversal(iterator root, Func&& func, Allocator alloc = {})
+    {
+        Workspace<Value, Allocator> workspace(alloc);
+        return iterativeEvaluationTraversal<Value>(root, func, workspace);
+    }
+
+    /// Same as above, using the buffers of `workspace`.
+    template <typename Value, typename Allocator, typename Func>
+    static std::pair<Value, iterator>
+    iterativeEvaluationTraversal(iterator root, Func&& func, Workspace<Value, Allocator>& workspace)
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
+                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+
+        using Frame = detail::EvaluationFrame<iterator>;
+        typename Crtp::Instrumentation::Probe probe;
+        auto& values = workspace.stack;
+        auto& stack = workspace.frames;
+        values.clear();
+        stack.clear();
+
+        // the innermost frame is kept out of the stack, and leaves never enter it
+        Frame top{root, Crtp::getChildrenCount(root), 0};
+        iterator node = root;
+        ++node;
+        while (true) {
+            while (top.remaining == 0) {
+                probe.onNode();
+                auto ret = func(top.node, values.data() + top.first_value,
+                                values.data() + values.size());
+                values.resize(top.first_value);
+                values.emplace_back(std::move(ret));
+                if (stack.empty())
+                    return {std::move(values.back()), node};
+                top = stack.back();
+                stack.pop_back();
+            }
+            --top.remaining;
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children == 0) {
+                Value* end = values.data() + values.size();
+                probe.onNode();
+                auto ret = func(node, end, end);
+                detail::pushInstrumented(probe, values, std::move(ret));
+            }
+            else {
+                detail::pushInstrumented(probe, stack, top);
+                top = {node, nb_children, values.size()};
+            }
+            ++node;
+        }
+    }
+
+private:
+    template <typename Func, typename NextSibling>
+    static iterator visit(iterator root, Func& func, NextSibling next_sibling)
+    {
+        static_assert(std::is_invocable_r_v<Visit, Func, iterator>,
+                      "Func must match the signature (iterator) -> Visit");
+
+        typename Crtp::Instrumentation::Probe probe;
+        probe.onNode();
+        switch (func(root)) {
+        case Visit::Continue: break;
+        case Visit::SkipSubtree: probe.onSiblingScan(); return next_sibling(root);
+        case Visit::Stop: return root;
+        }
+        std::vector<std::size_t> stack; // children left to visit for each ancestor of `top`
+        std::size_t top = Crtp::getChildrenCount(root);
+
+        iterator node = root;
+        ++node;
+        while (true) {
+            while (top == 0) {
+                if (stack.empty())
+                    return node;
+                top = stack.back();
+                stack.pop_back();
+            }
+            --top;
+            probe.onNode();
+            Visit action = func(node);
+            if (action == Visit::Stop)
+                return node;
+            std::size_t nb_children = Crtp::getChildrenCount(node);
+            if (nb_children == 0) {
+                ++node;
+            }
+            else if (action == Visit::SkipSubtree) {
+                probe.onSiblingScan();
+                node = next_sibling(node);
+            }
+            else {
+                detail::pushInstrumented(probe, stack, top);
+                top = nb_children;
+                ++node;
+            }
+        }
+    }
+
+    template <typename Value, typename Func, typename NextSibling, typename Executor>
+    static std::pair<Value, iterator> parallelEvaluation(iterator root,
+                                                         Func& func,
+                                                         NextSibling next_sibling,
+                                                         Executor& executor,
+                                                         std::size_t min_tasks)
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
+                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+        static_assert(detail::has_iterator_category_v<iterator, std::forward_iterator_tag>,
+                      "parallelEvaluationTraversal requires forward iterators");
+
+        // bounds the number of scans of the tree when it is too narrow to be split
+        constexpr std::size_t max_split_depth = 32;
+        if (min_tasks == 0)
+            min_tasks = 4 * std::max(std::thread::hardware_concurrency(), 1u);
+
+        // finding the subtrees to evaluate concurrently: all the nodes at depth `split_depth`
+        std::vector<iterator> tasks{root}, next_tasks;
+        std::size_t split_depth = 0;
+        while (tasks.size() < min_tasks && split_depth < max_split_depth) {
+            next_tasks.clear();
+            for (iterator node : tasks) {
+                std::size_t nb_children = Crtp::getChildrenCount(node);
+                iterator child = node;
+                ++child;
+                for (; nb_children != 0; --nb_children) {
+                    next_tasks.push_back(child);
+                    if (nb_children != 1)
+                        child = next_sibling(child);
+                }
+            }
+            if (next_tasks.empty())
+                break;
+            tasks.swap(next_tasks);
+            ++split_depth;
+        }
+        if (split_depth == 0)
+            return iterativeEvaluationTraversal<Value>(root, func);
+
+        std::vector<std::optional<std::pair<Value, iterator>>> results(tasks.size());
+        executor(tasks.size(), [&](std::size_t i) {
+            results[i].emplace(iterativeEvaluationTraversal<Value>(tasks[i], func));
+        });
+
+        // evaluating the top levels, with the value of each subtree at depth `split_depth`
+        using Frame = detail::EvaluationFrame<iterator>;
+        std::vector<Value> values;
+        std::vector<Frame> stack;
+        auto result = results.begin();
+
+        iterator node = root;
+        while (true) {
+            if (stack.size() == split_depth) {
+                values.emplace_back(std::move((*result)->first));
+                node = (*result)->second;
+                ++result;
+            }
+            else {
+                stack.push_back({node, Crtp::getChildrenCount(node), values.size()});
+                ++node;
+            }
+            while (stack.back().remaining == 0) {
+                Frame& frame = stack.back();
+                auto ret = func(frame.node, values.data() + frame.first_value,
+                                values.data() + values.size());
+                values.resize(frame.first_value);
+                values.emplace_back(std::move(ret));
+                stack.pop_back();
+                if (stack.empty())
+                    return {std::move(values.back()), node};
+            }
+            --stack.back().remaining;
+        }
+    }
+};
+
+/// Side index storing the size of every subtree of a node sequence.
+/// Once built, it answers `getNextSibling` and children enumeration in constant time.
+/// `Traits` must derive from `NodeTraits` and use random-access iterators.
+/// The sequence must not be modified while the index is in use.
+template <typename Traits>
+class SubtreeIndex {
+public:
+    using iterator = typename Traits::iterator;
+
+    static_assert(detail::is_random_access_v<iterator>,
+                  "SubtreeIndex requires random-access iterators");
+
+    /// Builds the index of [begin, end) in one pass. The sequence may contain several trees.
+    /// Throws std::length_error if the sequence has more than 2^32-1 nodes.
+    SubtreeIndex(iterator begin, iterator end) : begin_{begin}, size_(end - begin)
+    {
+        if (size_ > std::numeric_limits<std::uint32_t>::max())
+            throw std::length_error("SubtreeIndex: too many nodes");
+        storage_.resize(size_);
+        sizes_ = storage_.data();
+
+        // in reverse preorder, the subtrees of the children of a node are already known,
+        // and each child is the next sibling of the previous one
+        for (std::size_t i = size_; i-- != 0;) {
+            std::size_t nb_children = Traits::getChildrenCount(begin + i);
+            std::size_t child = i + 1;
+            for (; nb_children != 0 && child < size_; --nb_children)
+                child += storage_[child];
+            storage_[i] = static_cast<std::uint32_t>(child - i);
+        }
+    }
+
+    /// Uses the subtree sizes previously computed for the `size` nodes starting at `begin`,
+    /// for instance stored in a file (see `sizes()`). They are not copied and must outlive the
+    /// index.
+    SubtreeIndex(iterator begin, std::uint32_t const* sizes, std::size_t size) noexcept
+        : begin_{begin}, sizes_{sizes}, size_{size}
+    {
+    }
+
+    SubtreeIndex(SubtreeIndex const& other)
+        : begin_{other.begin_},
+          storage_{other.storage_},
+          sizes_{storage_.empty() ? other.sizes_ : storage_.data()},
+          size_{other.size_}
+    {
+    }
+    SubtreeIndex(SubtreeIndex&&) noexcept = default; // the storage keeps its buffer
+
+    SubtreeIndex& operator=(SubtreeIndex const& other)
+    {
+        return *this = SubtreeIndex(other);
+    }
+    SubtreeIndex& operator=(SubtreeIndex&&) noexcept = default;
+
+    /// Returns the number of nodes in the subtree of `node`, including `node` itself.
+    std::size_t getSubtreeSize(iterator node) const noexcept { return sizes_[node - begin_]; }
+
+    /// Returns an iterator past the last node of the subtree of `node`.
+    iterator getSubtreeEnd(iterator node) const noexcept { return node + getSubtreeSize(node); }
+
+    /// Iterates to the next sibling of the node.
+    iterator getNextSibling(iterator node) const noexcept { return getSubtreeEnd(node); }
+
+    /// Returns the number of children this node has.
+    std::size_t getChildrenCount(iterator node) const noexcept
+    {
+        return Traits::getChildrenCount(node);
+    }
+
+    /// Calls `func(iterator child)` for each child of `node`, in order.
+    template <typename Func>
+    void forEachChild(iterator node, Func&& func) const
+    {
+        static_assert(std::is_invocable_v<Func, iterator>,
+                      "Func must be invocable with (iterator)");
+        iterator end = getSubtreeEnd(node);
+        for (++node; node != end; node = getNextSibling(node))
+            func(node);
+    }
+
+    /// Returns the first node of the indexed sequence.
+    iterator begin() const noexcept { return begin_; }
+
+    /// Returns the subtree sizes, indexed by position in the sequence.
+    std::uint32_t const* sizes() const noexcept { return sizes_; }
+
+    /// Returns the number of indexed nodes.
+    std::size_t size() const noexcept { return size_; }
+
+private:
+    iterator begin_;
+    std::vector<std::uint32_t> storage_; // empty if the sizes are provided by the user
+    std::uint32_t const* sizes_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/// Value of every node of a sequence, as computed by `evaluationTraversal`, stored alongside the
+/// sequence. After nodes are modified, `update` recomputes these nodes and their ancestors only.
+/// The structure of the sequence must not change, and Value must be default constructible.
+/// Func must match the signature (iterator node, Value* begin, Value* end) -> Value: the values
+/// of the children are copied into a contiguous buffer before each call.
+template <typename Traits, typename Value>
+class EvaluationCache {
+public:
+    using iterator = typename Traits::iterator;
+
+    static_assert(std::is_default_constructible_v<Value>,
+                  "EvaluationCache requires a default constructible Value");
+
+    /// Evaluates every node of [begin, end). The sequence may contain several trees.
+    /// Throws std::length_error if the sequence has more than 2^32-1 nodes.
+    template <typename Func>
+    EvaluationCache(iterator begin, iterator end, Func&& func)
+        : index_(begin, end), parents_(index_.size(), npos), values_(parents_.size())
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
+                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+
+        std::size_t size = parents_.size();
+        for (std::size_t i = 0; i != size; ++i) {
+            std::size_t nb_children = Traits::getChildrenCount(begin + i);
+            std::size_t child = i + 1;
+            for (; nb_children != 0 && child < size; --nb_children) {
+                parents_[child] = static_cast<std::uint32_t>(i);
+                child += index_.sizes()[child];
+            }
+        }
+
+        // in reverse preorder, the children are evaluated before their parent
+        for (std::size_t i = size; i-- != 0;)
+            recompute(i, func);
+    }
+
+    /// Returns the value of `node`.
+    Value const& getValue(iterator node) const noexcept { return values_[node - index_.begin()]; }
+
+    /// Returns the values, indexed by position in the sequence.
+    std::vector<Value> const& values() const noexcept { return values_; }
+
+    /// Returns the index of the sequence, which is used to find the children of the nodes.
+    SubtreeIndex<Traits> const& index() const noexcept { return index_; }
+
+    /// Recomputes the value of `node`, which was modified, and the values of its ancestors.
+    template <typename Func>
+    void update(iterator node, Func&& func)
+    {
+        for (std::size_t i = node - index_.begin(); i != npos; i = parents_[i])
+            recompute(i, func);
+    }
+
+    /// Same as above, for each node of [first, last), which are iterators to modified nodes.
+    /// Their common ancestors are recomputed once, after all their modified descendants.
+    template <typename NodeIterator, typename Func>
+    void update(NodeIterator first, NodeIterator last, Func&& func)
+    {
+        // marking the paths to the roots, until a path already marked is reached
+        dirty_.resize(values_.size());
+        for (; first != last; ++first) {
+            std::size_t i = *first - index_.begin();
+            for (; i != npos && !dirty_[i]; i = parents_[i]) {
+                dirty_[i] = true;
+                pending_.push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+
+        // the descendants of a node come after it in preorder
+        std::sort(pending_.begin(), pending_.end(), std::greater<>{});
+        for (std::uint32_t i : pending_) {
+            recompute(i, func);
+            dirty_[i] = false;
+        }
+        pending_.clear();
+    }
+
+private:
+    static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+
+    template <typename Func>
+    void recompute(std::size_t i, Func& func)
+    {
+        children_.clear();
+        iterator node = index_.begin() + i;
+        index_.forEachChild(node, [&](iterator child) {
+            children_.push_back(values_[child - index_.begin()]);
+        });
+        values_[i] = func(node, children_.data(), children_.data() + children_.size());
+    }
+
+    SubtreeIndex<Traits> index_;
+    std::vector<std::uint32_t> parents_; // npos for the roots
+    std::vector<Value> values_;
+    std::vector<Value> children_; // values of the children of the node being recomputed
+    std::vector<bool> dirty_;
+    std::vector<std::uint32_t> pending_; // nodes to recompute, marked in `dirty_`
+};
+
+/// Hash-consed form of a node sequence, identifying equal subtrees by the same id: the sequence
+/// is represented as a DAG of its distinct subtrees, each stored once with the ids of its
+/// children. Evaluating the DAG computes the value of equal subtrees once.
+/// Subtrees are equal if their roots are equal according to `node_equal`, and if their children
+/// are equal subtrees. Hashes only select candidates, so collisions cannot merge different
+/// subtrees. The nodes are not copied: the DAG refers to the first occurrence of each subtree in
+/// the sequence, which must outlive it. `Traits` must use forward iterators.
+template <typename Traits>
+class SubtreeDag {
+public:
+    using iterator = typename Traits::iterator;
+    using id_type = std::uint32_t;
+
+    static_assert(detail::has_iterator_category_v<iterator, std::forward_iterator_tag>,
+                  "SubtreeDag requires forward iterators");
+
+    /// Builds the DAG of [begin, end) in one bottom-up pass. The sequence may contain several
+    /// trees. NodeHash must match the signature (iterator node) -> std::uint64_t, and NodeEqual the
+    /// signature (iterator lhs, iterator rhs) -> bool. They compare the nodes alone, not their
+    /// children. Throws std::length_error if there are more than 2^32-1 distinct subtrees.
+    template <typename NodeHash, typename NodeEqual>
+    SubtreeDag(iterator begin, iterator end, NodeHash&& node_hash, NodeEqual&& node_equal)
+    {
+        static_assert(std::is_invocable_r_v<std::uint64_t, NodeHash, iterator>,
+                      "NodeHash must match the signature (iterator) -> std::uint64_t");
+        static_assert(std::is_invocable_r_v<bool, NodeEqual, iterator, iterator>,
+                      "NodeEqual must match the signature (iterator, iterator) -> bool");
+
+        // the subtrees with the same hash are chained from the last one inserted
+        std::unordered_map<std::uint64_t, id_type> last_with_hash;
+        std::vector<id_type> previous_with_hash;
+
+        // the same hash as `NodeTraits::hashTraversal`, from the hashes of the children's ids
+        auto intern = [&](iterator node, id_type* first, id_type* last) {
+            std::uint64_t hash = hashCombine(node_hash(node), last - first);
+            for (id_type* child = first; child != last; ++child)
+                hash = hashCombine(hash, hashes_[*child]);
+
+            auto [bucket, inserted] = last_with_hash.try_emplace(hash, npos);
+            for (id_type id = bucket->second; id != npos; id = previous_with_hash[id]) {
+                auto [children, children_end] = getChildren(id);
+                if (std::equal(first, last, children, children_end) &&
+                    node_equal(nodes_[id], node))
+                    return id;
+            }
+
+            if (nodes_.size() == npos)
+                throw std::length_error("SubtreeDag: too many distinct subtrees");
+            auto id = static_cast<id_type>(nodes_.size());
+            nodes_.push_back(node);
+            hashes_.push_back(hash);
+            children_.insert(children_.end(), first, last);
+            child_offsets_.push_back(children_.size());
+            previous_with_hash.push_back(bucket->second);
+            bucket->second = id;
+            return id;
+        };
+
+        typename Traits::template Workspace<id_type> workspace;
+        while (begin != end) {
+            auto [id, next] =
+                Traits::template iterativeEvaluationTraversal<id_type>(begin, intern, workspace);
+            roots_.push_back(id);
+            begin = next;
+        }
+    }
+
+    /// Returns the number of distinct subtrees. Their ids are 0 to `size() - 1`, and the ids of
+    /// the children of a subtree are lower than its id.
+    std::size_t size() const noexcept { return nodes_.size(); }
+
+    /// Returns the ids of the trees of the sequence, in order.
+    std::vector<id_type> const& roots() const noexcept { return roots_; }
+
+    /// Returns the root of the first occurrence of the subtree `id` in the sequence.
+    iterator getNode(id_type id) const noexcept { return nodes_[id]; }
+
+    /// Returns the hash of the subtree `id`, equal to `NodeTraits::hashTraversal` of its root.
+    std::uint64_t getHash(id_type id) const noexcept { return hashes_[id]; }
+
+    /// Returns the range of the ids of the children of the subtree `id`.
+    std::pair<id_type const*, id_type const*> getChildren(id_type id) const noexcept
+    {
+        id_type const* children = children_.data();
+        return {children + child_offsets_[id], children + child_offsets_[id + 1]};
+    }
+
+    /// Evaluates each distinct subtree once, as `evaluationTraversal` would evaluate it, and
+    /// returns the values indexed by id. The values of the children are copied into a contiguous
+    /// buffer before each call.
+    /// Func must match the signature (iterator node, Value* begin, Value* end) -> Value
+    template <typename Value, typename Func>
+    std::vector<Value> evaluate(Func&& func) const
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
+                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+
+        std::vector<Value> values, children;
+        values.reserve(size());
+        for (std::size_t id = 0; id != size(); ++id) {
+            children.clear();
+            for (auto [child, end] = getChildren(static_cast<id_type>(id)); child != end; ++child)
+                children.push_back(values[*child]);
+            values.push_back(func(nodes_[id], children.data(), children.data() + children.size()));
+        }
+        return values;
+    }
+
+private:
+    static constexpr id_type npos = std::numeric_limits<id_type>::max();
+
+    std::vector<iterator> nodes_;
+    std::vector<std::uint64_t> hashes_;
+    std::vector<std::size_t> child_offsets_{0}; // the children of `id` start at child_offsets_[id]
+    std::vector<id_type> children_;
+    std::vector<id_type> roots_;
+};
+
+/// Returns a pointer past the subtree whose root is at `arities`, a column of children counts
+/// in preorder. This is the same scan as `NodeTraits::getNextSibling`, but while `n` nodes are
+/// pending, the subtree cannot end in the next `n` nodes (each node reduces the number of pending
+/// nodes by at most one). These nodes are then only summed, in a loop which compilers vectorize.
+template <typename Arity>
+Arity const* findSubtreeEnd(Arity const* arities) noexcept
+{
+    // under this number of pending nodes, summing them is not worth it
+    constexpr std::size_t min_block = 16;
+
+    std::size_t remaining = 1;
+    do {
+        remaining = remaining + *arities - 1;
+        ++arities;
+        while (remaining >= min_block) {
+            std::size_t length = remaining, sum = 0;
+            for (std::size_t i = 0; i != length; ++i)
+                sum += arities[i];
+            arities += length;
+            remaining = remaining + sum - length;
+        }
+    } while (remaining != 0);
+    return arities;
+}
+
+namespace detail {
+
+    /// Node of the arity column whose children are not all visited yet.
+    struct LevelFrame {
+        std::uint32_t node;
+        std::size_t remaining;
+    };
+
+    /// Fills the depths and parents of the nodes [begin, end) of the arity column, as if the
+    /// range was a sequence of trees. When `stack` is empty, the next node is given the depth 0
+    /// and no parent: these nodes are the roots of the range. Returns their number, and leaves
+    /// in `stack` the nodes whose children are not all in the range.
+    template <typename Arity>
+    std::size_t fillLevels(Arity const* arities,
+                           std::size_t begin,
+                           std::size_t end,
+                           std::uint32_t* depths,
+                           std::uint32_t* parents,
+                           std::vector<LevelFrame>& stack)
+    {
+        constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+        std::size_t nb_roots = 0;
+        for (std::size_t i = begin; i != end; ++i) {
+            if (stack.empty()) {
+                depths[i] = 0;
+                parents[i] = npos;
+                ++nb_roots;
+            }
+            else {
+                LevelFrame& top = stack.back();
+                depths[i] = depths[top.node] + 1;
+                parents[i] = top.node;
+                if (--top.remaining == 0)
+                    stack.pop_back();
+            }
+            if (arities[i] != 0)
+                stack.push_back({static_cast<std::uint32_t>(i), arities[i]});
+        }
+        return nb_roots;
+    }
+
+} // namespace detail
+
+/// Fills `depths[i]` and `parents[i]` for the first `size` nodes of `arities`, a column of
+/// children counts in preorder (for instance `FlatTree::arities()`). The column may contain
+/// several trees. Roots have the depth 0 and the parent `std::numeric_limits<uint32_t>::max()`.
+/// Throws std::length_error if there are more than 2^32-1 nodes.
+template <typename Arity>
+void fillDepthsAndParents(Arity const* arities,
+                          std::size_t size,
+                          std::uint32_t* depths,
+                          std::uint32_t* parents)
+{
+    if (size > std::numeric_limits<std::uint32_t>::max())
+        throw std::length_error("fillDepthsAndParents: too many nodes");
+    std::vector<detail::LevelFrame> stack;
+    detail::fillLevels(arities, 0, size, depths, parents, stack);
+}
+
+/// Same as `fillDepthsAndParents`, computed concurrently by `executor` (see ThreadExecutor) on
+/// `min_tasks` chunks of the column (by default, 4 chunks per hardware thread).
+/// Each chunk is first filled as if it started a new tree, keeping aside the nodes whose parent
+/// is in a previous chunk and the nodes whose children continue in a next chunk. A serial pass
+/// then matches them chunk by chunk, with one step per pending parent (this is bounded by the
+/// depth of the tree). Finally, each chunk adds the depth of its first nodes to their descendants.
+template <typename Arity, typename Executor = ThreadExecutor>
+void parallelFillDepthsAndParents(Arity const* arities,
+                                  std::size_t size,
+                                  std::uint32_t* depths,
+                                  std::uint32_t* parents,
+                                  Executor executor = {},
+                                  std::size_t min_tasks = 0)
+{
+    constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+    if (size > npos)
+        throw std::length_error("parallelFillDepthsAndParents: too many nodes");
+    if (size == 0)
+        return;
+    if (min_tasks == 0)
+        min_tasks = 4 * std::max(std::thread::hardware_concurrency(), 1u);
+    std::size_t chunk_size = std::max<std::size_t>(size / min_tasks, 1);
+    std::size_t nb_chunks = (size + chunk_size - 1) / chunk_size;
+    auto chunk_end = [&](std::size_t chunk) { return std::min(size, (chunk + 1) * chunk_size); };
+
+    // the first nodes of a chunk, until its stack is not empty, are given the depth 0
+    std::vector<std::size_t> nb_heads(nb_chunks);
+    std::vector<std::vector<detail::LevelFrame>> open_frames(nb_chunks);
+    executor(nb_chunks, [&](std::size_t chunk) {
+        nb_heads[chunk] = detail::fillLevels(arities, chunk * chunk_size, chunk_end(chunk),
+                                             depths, parents, open_frames[chunk]);
+    });
+
+    // the heads take the next children of the frames left open by the previous chunks:
+    // `groups[chunk]` lists the consecutive heads which have the same parent
+    struct HeadGroup {
+        std::size_t first_head;
+        std::uint32_t parent;
+        std::uint32_t depth;
+    };
+    struct Frame {
+        std::uint32_t node;
+        std::size_t remaining;
+        std::uint32_t depth;
+    };
+    std::vector<std::vector<HeadGroup>> groups(nb_chunks);
+    std::vector<Frame> stack;
+    for (std::size_t chunk = 0; chunk != nb_chunks; ++chunk) {
+        for (std::size_t head = 0; head != nb_heads[chunk];) {
+            if (stack.empty()) { // the remaining heads are roots
+                groups[chunk].push_back({head, npos, 0});
+                break;
+            }
+            Frame& top = stack.back();
+            std::size_t nb_children = std::min(top.remaining, nb_heads[chunk] - head);
+            groups[chunk].push_back({head, top.node, top.depth + 1});
+            head += nb_children;
+            top.remaining -= nb_children;
+            if (top.remaining == 0)
+                stack.pop_back();
+        }
+        // the open frames are in the subtree of the last head
+        std::uint32_t offset = groups[chunk].back().depth;
+        for (auto frame : open_frames[chunk])
+            stack.push_back({frame.node, frame.remaining, depths[frame.node] + offset});
+    }
+
+    // the first chunk only has roots as heads
+    executor(nb_chunks - 1, [&](std::size_t task) {
+        std::size_t chunk = task + 1;
+        auto group = groups[chunk].begin(), next_group = group + 1;
+        std::size_t head = 0;
+        std::uint32_t offset = 0;
+        for (std::size_t i = chunk * chunk_size, end = chunk_end(chunk); i != end; ++i) {
+            if (depths[i] == 0) {
+                if (next_group != groups[chunk].end() && next_group->first_head == head)
+                    group = next_group++;
+                parents[i] = group->parent;
+                offset = group->depth;
+                ++head;
+            }
+            depths[i] += offset;
+        }
+    });
+}
+
+namespace detail {
+
+    /// Returns the number of bits set in `word`.
+    inline std::size_t popcount(std::uint64_t word) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<std::size_t>(__builtin_popcountll(word));
+#else
+        word = word - ((word >> 1) & 0x5555555555555555u);
+        word = (word & 0x3333333333333333u) + ((word >> 2) & 0x3333333333333333u);
+        word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fu;
+        return static_cast<std::size_t>((word * 0x0101010101010101u) >> 56);
+#endif
+    }
+
+    /// Returns the position of the lowest bit set in `word`, which must not be 0.
+    inline unsigned lowestBit(std::uint32_t word) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(__builtin_ctz(word));
+#else
+        unsigned bit = 0;
+        for (; (word & 1) == 0; word >>= 1)
+            ++bit;
+        return bit;
+#endif
+    }
+
+    /// Returns the position of the highest bit set in `word`, which must not be 0.
+    inline unsigned highestBit(std::uint64_t word) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(63 - __builtin_clzll(word));
+#else
+        unsigned bit = 0;
+        while (word >>= 1)
+            ++bit;
+        return bit;
+#endif
+    }
+
+} // namespace detail
+
+/// Side index answering ancestry queries on a static node sequence: whether a node is in the
+/// subtree of another in constant time (subtrees are contiguous in preorder), the lowest common
+/// ancestor of two nodes in constant time, and the k-th ancestor of a node in logarithmic time.
+/// The sequence may contain several trees. It takes about 20 bytes per node, and 4 per depth.
+/// `Traits` must derive from `NodeTraits` and use random-access iterators.
+/// The sequence must not be modified while the index is in use.
+template <typename Traits>
+class AncestorIndex {
+public:
+    using iterator = typename Traits::iterator;
+
+    static_assert(detail::is_random_access_v<iterator>,
+                  "AncestorIndex requires random-access iterators");
+
+    /// Builds the index of [begin, end) in two passes.
+    /// Throws std::length_error if the sequence has more than 2^32-1 nodes.
+    AncestorIndex(iterator begin, iterator end) : index_{begin, end}
+    {
+        std::size_t size = index_.size();
+        depths_.resize(size);
+        parents_.resize(size);
+        std::vector<detail::LevelFrame> stack;
+        std::size_t max_depth = 0;
+        for (std::size_t i = 0; i != size; ++i) {
+            if (stack.empty()) {
+                depths_[i] = 0;
+                parents_[i] = npos;
+            }
+            else {
+                parents_[i] = stack.back().node;
+                depths_[i] = depths_[parents_[i]] + 1;
+                max_depth = std::max<std::size_t>(max_depth, depths_[i]);
+                if (--stack.back().remaining == 0)
+                    stack.pop_back();
+            }
+            if (std::size_t nb_children = Traits::getChildrenCount(begin + i))
+                stack.push_back({static_cast<std::uint32_t>(i), nb_children});
+        }
+
+        // the nodes of each depth, in preorder
+        depth_offsets_.assign(size == 0 ? 1 : max_depth + 2, 0);
+        for (std::size_t i = 0; i != size; ++i)
+            ++depth_offsets_[depths_[i] + 1];
+        std::partial_sum(depth_offsets_.begin(), depth_offsets_.end(), depth_offsets_.begin());
+        by_depth_.resize(size);
+        std::vector<std::uint32_t> next(depth_offsets_.begin(), depth_offsets_.end() - 1);
+        for (std::size_t i = 0; i != size; ++i)
+            by_depth_[next[depths_[i]]++] = static_cast<std::uint32_t>(i);
+
+        // within a block, bit j of `masks_[i]` is set if the node j of the block is shallower
+        // than the nodes after it up to i: the lowest bit from l is the shallowest of [l, i]
+        masks_.resize(size);
+        for (std::size_t block = 0; block < size; block += block_size) {
+            std::uint32_t mask = 0;
+            for (std::size_t i = block; i != std::min(size, block + block_size); ++i) {
+                while (mask != 0 && depths_[block + detail::highestBit(mask)] > depths_[i])
+                    mask ^= std::uint32_t{1} << detail::highestBit(mask);
+                mask |= std::uint32_t{1} << (i - block);
+                masks_[i] = mask;
+            }
+        }
+
+        // sparse table of the shallowest node of 2^level consecutive blocks
+        std::size_t nb_blocks = (size + block_size - 1) / block_size;
+        for (std::size_t b = 0; b != nb_blocks; ++b) {
+            std::size_t last = std::min(size, (b + 1) * block_size) - 1;
+            table_.push_back(shallowestInBlock(b * block_size, last));
+        }
+        for (std::size_t level = 1; (std::size_t{1} << level) <= nb_blocks; ++level) {
+            std::size_t previous = (level - 1) * nb_blocks, half = std::size_t{1} << (level - 1);
+            for (std::size_t b = 0; b != nb_blocks; ++b) {
+                std::uint32_t first = table_[previous + b];
+                table_.push_back(b + half < nb_blocks
+                                     ? shallowest(first, table_[previous + b + half])
+                                     : first);
+            }
+        }
+    }
+
+    /// Returns the end of the indexed sequence, returned when there is no such node.
+    iterator end() const noexcept { return index_.begin() + index_.size(); }
+
+    /// Returns true if `node` is in the subtree of `ancestor`, including `ancestor` itself.
+    bool isAncestor(iterator ancestor, iterator node) const noexcept
+    {
+        return ancestor <= node && node < index_.getSubtreeEnd(ancestor);
+    }
+
+    /// Returns the depth of `node`, 0 for the roots.
+    std::size_t getDepth(iterator node) const noexcept { return depths_[position(node)]; }
+
+    /// Returns the parent of `node`, or `end()` for the roots.
+    iterator getParent(iterator node) const noexcept
+    {
+        return toIterator(parents_[position(node)]);
+    }
+
+    /// Returns the ancestor `k` levels above `node` (`node` itself if `k` is 0), or `end()` if
+    /// `node` has less than `k` ancestors. It is the last node before `node`, in preorder,
+    /// at its depth: found with a binary search among the nodes of this depth.
+    iterator getAncestor(iterator node, std::size_t k) const noexcept
+    {
+        std::size_t depth = getDepth(node);
+        if (k > depth)
+            return end();
+        auto first = by_depth_.begin() + depth_offsets_[depth - k];
+        auto last = by_depth_.begin() + depth_offsets_[depth - k + 1];
+        return toIterator(*(std::upper_bound(first, last, position(node)) - 1));
+    }
+
+    /// Returns the deepest node which is an ancestor of both `a` and `b`, or `end()` if they
+    /// are in different trees. In preorder, between two nodes `a < b` which are not ancestor and
+    /// descendant, the shallowest nodes of (a, b] are children of their lowest common ancestor.
+    iterator getLowestCommonAncestor(iterator a, iterator b) const noexcept
+    {
+        std::size_t first = position(a), last = position(b);
+        if (first == last)
+            return a;
+        if (first > last)
+            std::swap(first, last);
+        return toIterator(parents_[shallowestInRange(first + 1, last)]);
+    }
+
+    /// Returns the subtree sizes used by the ancestor test.
+    SubtreeIndex<Traits> const& subtreeIndex() const noexcept { return index_; }
+
+    /// Returns the number of indexed nodes.
+    std::size_t size() const noexcept { return index_.size(); }
+
+private:
+    static constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::size_t block_size = 32;
+
+    std::uint32_t position(iterator node) const noexcept
+    {
+        return static_cast<std::uint32_t>(node - index_.begin());
+    }
+
+    iterator toIterator(std::uint32_t position) const noexcept
+    {
+        return position == npos ? end() : index_.begin() + position;
+    }
+
+    std::uint32_t shallowest(std::uint32_t a, std::uint32_t b) const noexcept
+    {
+        return depths_[b] < depths_[a] ? b : a;
+    }
+
+    /// Returns the shallowest node of [first, last], in the same block.
+    std::uint32_t shallowestInBlock(std::size_t first, std::size_t last) const noexcept
+    {
+        std::size_t block = first - first % block_size;
+        std::uint32_t mask = masks_[last] & (~std::uint32_t{0} << (first - block));
+        return static_cast<std::uint32_t>(block + detail::lowestBit(mask));
+    }
+
+    /// Returns the shallowest node of [first, last].
+    std::uint32_t shallowestInRange(std::size_t first, std::size_t last) const noexcept
+    {
+        std::size_t first_block = first / block_size, last_block = last / block_size;
+        if (first_block == last_block)
+            return shallowestInBlock(first, last);
+        std::uint32_t result =
+            shallowest(shallowestInBlock(first, first_block * block_size + block_size - 1),
+                       shallowestInBlock(last_block * block_size, last));
+        if (first_block + 1 != last_block) {
+            std::size_t begin = first_block + 1, nb_blocks = last_block - begin;
+            std::size_t level = detail::highestBit(nb_blocks);
+            std::size_t row = level * ((index_.size() + block_size - 1) / block_size);
+            result = shallowest(result, table_[row + begin]);
+            result = shallowest(result, table_[row + last_block - (std::size_t{1} << level)]);
+        }
+        return result;
+    }
+
+    SubtreeIndex<Traits> index_;
+    std::vector<std::uint32_t> depths_;
+    std::vector<std::uint32_t> parents_;       // npos for the roots
+    std::vector<std::uint32_t> by_depth_;      // the nodes sorted by depth, then in preorder
+    std::vector<std::uint32_t> depth_offsets_; // the nodes of depth d start at depth_offsets_[d]
+    std::vector<std::uint32_t> masks_;         // see the constructor
+    std::vector<std::uint32_t> table_;         // row `level` covers 2^level blocks
+};
+
+/// Iterator over a FlatTree, pointing both to the arity and to the payload of a node.
+template <typename Payload, typename Arity>
+class FlatTreeIterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Payload;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Payload const*;
+    using reference = Payload const&;
+
+    FlatTreeIterator() noexcept = default;
+    FlatTreeIterator(Arity const* arity, Payload const* payload) noexcept
+        : arity_{arity}, payload_{payload}
+    {
+    }
+
+    /// Returns the number of children of the node.
+    Arity arity() const noexcept { return *arity_; }
+
+    /// Returns the position of the node in the arity column.
+    Arity const* arityData() const noexcept { return arity_; }
+
+    reference operator*() const noexcept { return *payload_; }
+    pointer operator->() const noexcept { return payload_; }
+    reference operator[](difference_type n) const noexcept { return payload_[n]; }
+
+    FlatTreeIterator& operator++() noexcept { return *this += 1; }
+    FlatTreeIterator& operator--() noexcept { return *this -= 1; }
+    FlatTreeIterator operator++(int) noexcept { return std::exchange(*this, *this + 1); }
+    FlatTreeIterator operator--(int) noexcept { return std::exchange(*this, *this - 1); }
 
-    /// Returns the number of children this node has.
-    static constexpr std::size_t getChildrenCount(iterator node) noexcept = delete;
+    FlatTreeIterator& operator+=(difference_type n) noexcept
+    {
+        arity_ += n;
+        payload_ += n;
+        return *this;
+    }
+    FlatTreeIterator& operator-=(difference_type n) noexcept { return *this += -n; }
 
-    /// Iterates to the next sibling of the node.
-    static constexpr iterator getNextSibling(iterator node) noexcept
+    friend FlatTreeIterator operator+(FlatTreeIterator it, difference_type n) noexcept
     {
-        std::size_t remaining_nodes = 1;
-        do {
-            remaining_nodes = remaining_nodes + Crtp::getChildrenCount(node) - 1;
-            ++node;
-        } while (remaining_nodes > 0);
-        return node;
+        return it += n;
+    }
+    friend FlatTreeIterator operator+(difference_type n, FlatTreeIterator it) noexcept
+    {
+        return it += n;
+    }
+    friend FlatTreeIterator operator-(FlatTreeIterator it, difference_type n) noexcept
+    {
+        return it -= n;
+    }
+    friend difference_type operator-(FlatTreeIterator lhs, FlatTreeIterator rhs) noexcept
+    {
+        return lhs.arity_ - rhs.arity_;
     }
 
-    /// Base algorithm to recursively traverse the tree.
-    /// Example:
-    ///     void my_function(iterator root) {
-    ///         /* init */
-    ///         recursive_traversal(root, [&](iterator node, auto& self) {
-    ///             /* code to evaluate before node's children
-    ///             auto next_node = recursive_traversal(node, self);
-    ///             /* code to evaluate after node's children
-    ///             return next_node;
-    ///         });
-    ///     }
-    /// Returns an iterator to the end of the tree.
+    friend bool operator==(FlatTreeIterator lhs, FlatTreeIterator rhs) noexcept
+    {
+        return lhs.arity_ == rhs.arity_;
+    }
+    friend bool operator!=(FlatTreeIterator lhs, FlatTreeIterator rhs) noexcept
+    {
+        return lhs.arity_ != rhs.arity_;
+    }
+    friend bool operator<(FlatTreeIterator lhs, FlatTreeIterator rhs) noexcept
+    {
+        return lhs.arity_ < rhs.arity_;
+    }
+    friend bool operator>(FlatTreeIterator lhs, FlatTreeIterator rhs) noexcept
+    {
+        return lhs.arity_ > rhs.arity_;
+    }
+    friend bool operator<=(FlatTreeIterator lhs, FlatTreeIterator rhs) noexcept
+    {
+        return lhs.arity_ <= rhs.arity_;
+    }
+    friend bool operator>=(FlatTreeIterator lhs, FlatTreeIterator rhs) noexcept
+    {
+        return lhs.arity_ >= rhs.arity_;
+    }
+
+private:
+    Arity const* arity_ = nullptr;
+    Payload const* payload_ = nullptr;
+};
+
+/// NodeTraits of a FlatTree, reading children counts from the arity column only.
+template <typename Payload, typename Arity>
+struct FlatTreeTraits
+    : NodeTraits<FlatTreeIterator<Payload, Arity>, FlatTreeTraits<Payload, Arity>> {
+    using iterator = FlatTreeIterator<Payload, Arity>;
+
+    static std::size_t getChildrenCount(iterator it) noexcept { return it.arity(); }
+
+    /// Iterates to the next sibling of the node, using `findSubtreeEnd` on the arity column.
+    static iterator getNextSibling(iterator node) noexcept
+    {
+        return node + (findSubtreeEnd(node.arityData()) - node.arityData());
+    }
+};
+
+/// Non-owning view of the two columns of a FlatTree, for instance mapped from a file
+/// (see <jv/flat-tree-file.hpp>). The algorithms run on it through `FlatTreeView::traits`.
+template <typename Payload, typename Arity = std::uint32_t>
+class FlatTreeView {
+public:
+    using traits = FlatTreeTraits<Payload, Arity>;
+    using iterator = FlatTreeIterator<Payload, Arity>;
+
+    FlatTreeView() noexcept = default;
+    FlatTreeView(Arity const* arities, Payload const* payloads, std::size_t size) noexcept
+        : arities_{arities}, payloads_{payloads}, size_{size}
+    {
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    iterator begin() const noexcept { return {arities_, payloads_}; }
+    iterator end() const noexcept { return begin() + size(); }
+
+    /// The children count of each node, in preorder.
+    Arity const* arities() const noexcept { return arities_; }
+
+    /// The payload of each node, in preorder.
+    Payload const* payloads() const noexcept { return payloads_; }
+
+    /// Returns the payload of the node at position `index`.
+    Payload const& payload(std::size_t index) const noexcept { return payloads_[index]; }
+
+private:
+    Arity const* arities_ = nullptr;
+    Payload const* payloads_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/// Tree stored in preorder as two columns: a dense column of children counts, and a column of
+/// payloads. Passes on the structure only (getNextSibling, SubtreeIndex, getDepth...) do not
+/// touch the payloads.
+/// Use `FlatTree::traits` to run algorithms on it.
+template <typename Payload, typename Arity = std::uint32_t>
+class FlatTree {
+public:
+    static_assert(std::is_unsigned_v<Arity>, "Arity must be an unsigned integer type");
+
+    using traits = FlatTreeTraits<Payload, Arity>;
+    using iterator = FlatTreeIterator<Payload, Arity>;
+
+    /// Appends a node in preorder. Throws std::overflow_error if `arity` does not fit in `Arity`.
+    void push_back(Payload payload, std::size_t arity)
+    {
+        if (arity > std::numeric_limits<Arity>::max())
+            throw std::overflow_error("FlatTree: too many children");
+        arities_.push_back(static_cast<Arity>(arity));
+        payloads_.push_back(std::move(payload));
+    }
+
+    void reserve(std::size_t size)
+    {
+        arities_.reserve(size);
+        payloads_.reserve(size);
+    }
+
+    /// Returns the number of nodes that fit without reallocating either column.
+    std::size_t capacity() const noexcept
+    {
+        return std::min(arities_.capacity(), payloads_.capacity());
+    }
+
+    /// Removes all the nodes, but keeps the capacity.
+    void clear() noexcept
+    {
+        arities_.clear();
+        payloads_.clear();
+    }
+
+    std::size_t size() const noexcept { return arities_.size(); }
+    bool empty() const noexcept { return arities_.empty(); }
+
+    iterator begin() const noexcept { return {arities_.data(), payloads_.data()}; }
+    iterator end() const noexcept { return begin() + size(); }
+
+    /// The children count of each node, in preorder.
+    std::vector<Arity> const& arities() const noexcept { return arities_; }
+
+    /// The payload of each node, in preorder.
+    std::vector<Payload> const& payloads() const noexcept { return payloads_; }
+
+    /// Returns a view of the tree, which is invalidated when nodes are added.
+    FlatTreeView<Payload, Arity> view() const noexcept
+    {
+        return {arities_.data(), payloads_.data(), size()};
+    }
+
+    /// Returns the payload of the node at position `index`.
+    /// Payloads can be modified, but not the structure of the tree.
+    Payload& payload(std::size_t index) noexcept { return payloads_[index]; }
+    Payload const& payload(std::size_t index) const noexcept { return payloads_[index]; }
+
+    /// Changes the children count of the node at position `index`, for instance once its
+    /// children are written (see `NodeTraits::transformTraversal`). The nodes must form valid
+    /// trees again before running algorithms on them.
+    /// Throws std::overflow_error if `arity` does not fit in `Arity`.
+    void setArity(std::size_t index, std::size_t arity)
+    {
+        if (arity > std::numeric_limits<Arity>::max())
+            throw std::overflow_error("FlatTree: too many children");
+        arities_[index] = static_cast<Arity>(arity);
+    }
+
+private:
+    std::vector<Arity> arities_;
+    std::vector<Payload> payloads_;
+};
+
+/// Returned by the callback of `NodeTraits::transformTraversal`: what becomes of a node of the
+/// input tree in the output tree.
+template <typename Payload, typename Arity = std::uint32_t>
+class Transform {
+public:
+    enum class Kind {
+        Keep,   // writes the node with `payload()`, followed by its transformed children
+        Leaf,   // writes a leaf with `payload()` instead of the subtree of the node
+        Insert, // writes a copy of `forest()` instead of the subtree of the node
+        Remove, // writes nothing for the subtree of the node
+        Splice, // writes the transformed children of the node in its place
+    };
+
+    static Transform keep(Payload payload) { return {Kind::Keep, std::move(payload)}; }
+    static Transform leaf(Payload payload) { return {Kind::Leaf, std::move(payload)}; }
+
+    /// `forest` may contain zero or several trees, and must stay valid during the call of
+    /// `transformTraversal`.
+    static Transform insert(FlatTreeView<Payload, Arity> forest) noexcept
+    {
+        Transform result{Kind::Insert, std::nullopt};
+        result.forest_ = forest;
+        return result;
+    }
+    static Transform remove() noexcept { return {Kind::Remove, std::nullopt}; }
+    static Transform splice() noexcept { return {Kind::Splice, std::nullopt}; }
+
+    Kind kind() const noexcept { return kind_; }
+
+    /// Payload of `Keep` and `Leaf`.
+    Payload& payload() noexcept { return *payload_; }
+
+    /// Trees of `Insert`.
+    FlatTreeView<Payload, Arity> forest() const noexcept { return forest_; }
+
+private:
+    Transform(Kind kind, std::optional<Payload> payload) : kind_{kind}, payload_{std::move(payload)}
+    {
+    }
+
+    Kind kind_;
+    std::optional<Payload> payload_;
+    FlatTreeView<Payload, Arity> forest_;
+};
+
+/// Copy of a flat tree in a layout suited to random queries on subtrees. In preorder, the
+/// children of a node are separated by the subtrees of their previous siblings. Here, the nodes
+/// are grouped in blocks of about `block_size` nodes, each filled in breadth-first order from a
+/// group of siblings: the top levels of any subtree are in a few blocks, and the children of each
+/// node are contiguous. The groups which do not fit in a block start new blocks, in depth-first
+/// order, so the blocks of a subtree are close to each other.
+/// Nodes are identified by their position in the layout, see `position` and `preorderIndex` for
+/// the mapping to the preorder positions of the original tree.
+template <typename Payload, typename Arity = std::uint32_t>
+class BlockedLayout {
+public:
+    static constexpr std::size_t default_block_size = 256;
+
+    /// Copies `tree`, which may contain several trees: the roots are at the positions
+    /// [0, rootsCount()). Throws std::length_error if it has more than 2^32-1 nodes.
+    explicit BlockedLayout(FlatTreeView<Payload, Arity> tree,
+                           std::size_t block_size = default_block_size)
+        : block_size_{std::max<std::size_t>(block_size, 1)}
+    {
+        using Traits = FlatTreeTraits<Payload, Arity>;
+        SubtreeIndex<Traits> index(tree.begin(), tree.end()); // throws above 2^32-1 nodes
+        std::size_t size = tree.size();
+        arities_.reserve(size);
+        payloads_.reserve(size);
+        first_children_.resize(size);
+        preorder_.reserve(size);
+        positions_.resize(size);
+
+        // appends the group of `nb_children` siblings starting at `first` in preorder, and
+        // returns its position
+        auto place_group = [&](std::size_t first, std::size_t nb_children) {
+            std::size_t position = preorder_.size();
+            for (std::size_t i = first; nb_children != 0; --nb_children) {
+                positions_[i] = static_cast<std::uint32_t>(preorder_.size());
+                preorder_.push_back(static_cast<std::uint32_t>(i));
+                arities_.push_back(tree.arities()[i]);
+                payloads_.push_back(tree.payload(i));
+                i += index.sizes()[i];
+            }
+            return position;
+        };
+
+        for (std::size_t i = 0; i < size; i += index.sizes()[i])
+            ++nb_roots_;
+        place_group(0, nb_roots_);
+
+        // each block is filled breadth-first from the group at `block_begin`; the groups which
+        // do not fit are pending, identified by the position of their parent
+        std::vector<std::uint32_t> pending, deferred;
+        std::size_t block_begin = 0;
+        while (true) {
+            for (std::size_t next = block_begin; next != preorder_.size(); ++next) {
+                std::size_t nb_children = arities_[next];
+                if (nb_children == 0)
+                    continue;
+                if (preorder_.size() + nb_children - block_begin <= block_size_)
+                    first_children_[next] = static_cast<std::uint32_t>(
+                        place_group(preorder_[next] + 1, nb_children));
+                else
+                    deferred.push_back(static_cast<std::uint32_t>(next));
+            }
+            // the first deferred group is placed first
+            pending.insert(pending.end(), deferred.rbegin(), deferred.rend());
+            deferred.clear();
+            if (pending.empty())
+                break;
+            std::size_t parent = pending.back();
+            pending.pop_back();
+            block_begin = preorder_.size();
+            first_children_[parent] = static_cast<std::uint32_t>(
+                place_group(preorder_[parent] + 1, arities_[parent]));
+        }
+    }
+
+    std::size_t size() const noexcept { return preorder_.size(); }
+    std::size_t blockSize() const noexcept { return block_size_; }
+
+    /// Returns the number of roots, which are at the positions [0, rootsCount()).
+    std::size_t rootsCount() const noexcept { return nb_roots_; }
+
+    /// Returns the number of children of the node at `position`.
+    std::size_t getChildrenCount(std::size_t position) const noexcept
+    {
+        return arities_[position];
+    }
+
+    /// Returns the position of the first child of the node at `position`: its children are
+    /// contiguous, from this position to `getFirstChild(position) + getChildrenCount(position)`.
+    std::size_t getFirstChild(std::size_t position) const noexcept
+    {
+        return first_children_[position];
+    }
+
+    Payload const& payload(std::size_t position) const noexcept { return payloads_[position]; }
+
+    /// Returns the position in the original tree of the node at `position`.
+    std::size_t preorderIndex(std::size_t position) const noexcept { return preorder_[position]; }
+
+    /// Returns the position in the layout of the node at `preorder_index` in the original tree.
+    std::size_t position(std::size_t preorder_index) const noexcept
+    {
+        return positions_[preorder_index];
+    }
+
+    /// Same as `NodeTraits::iterativeEvaluationTraversal` on the subtree of the node at
+    /// `position`, following the children of each node in the layout.
+    /// Func must match the signature (std::size_t position, Value* begin, Value* end) -> Value
+    template <typename Value, typename Func>
+    Value evaluate(std::size_t position, Func&& func) const
+    {
+        static_assert(std::is_invocable_r_v<Value, Func, std::size_t, Value*, Value*>,
+                      "Func must match the signature (std::size_t, Value*, Value*) -> Value");
+
+        struct Frame {
+            std::size_t node;
+            std::size_t next_child;
+            std::size_t first_value;
+        };
+        std::vector<Value> values;
+        std::vector<Frame> stack;
+
+        // the innermost frame is kept out of the stack, and leaves never enter it
+        if (arities_[position] == 0)
+            return func(position, nullptr, nullptr);
+        Frame top{position, first_children_[position], 0};
+        while (true) {
+            while (top.next_child == first_children_[top.node] + arities_[top.node]) {
+                auto ret = func(top.node, values.data() + top.first_value,
+                                values.data() + values.size());
+                values.resize(top.first_value);
+                if (stack.empty())
+                    return ret;
+                values.emplace_back(std::move(ret));
+                top = stack.back();
+                stack.pop_back();
+            }
+            std::size_t node = top.next_child++;
+            if (arities_[node] == 0) {
+                Value* end = values.data() + values.size();
+                values.emplace_back(func(node, end, end));
+            }
+            else {
+                stack.push_back(top);
+                top = {node, first_children_[node], values.size()};
+            }
+        }
+    }
+
+    /// Same as `NodeTraits::visitTraversal` on the subtree of the node at `position`: visits the
+    /// nodes in preorder, and prunes the subtrees for which `func` returns `Visit::SkipSubtree`.
+    /// Func must match the signature (std::size_t position) -> Visit
+    /// Returns false if the traversal was stopped with `Visit::Stop`.
     template <typename Func>
-    static iterator recursiveTraversal(iterator node, Func&& func)
+    bool visit(std::size_t position, Func&& func) const
     {
+        static_assert(std::is_invocable_r_v<Visit, Func, std::size_t>,
+                      "Func must match the signature (std::size_t) -> Visit");
 
-        std::size_t nb_children = Crtp::getChildrenCount(node);
-        ++node;
-        for (; nb_children != 0; --nb_children) {
-            node = func(node, func);
+        // ranges of the children left to visit, in the layout
+        std::vector<std::pair<std::size_t, std::size_t>> stack;
+        std::size_t node = position, end = position + 1;
+        while (true) {
+            if (node == end) {
+                if (stack.empty())
+                    return true;
+                std::tie(node, end) = stack.back();
+                stack.pop_back();
+                continue;
+            }
+            std::size_t current = node++;
+            Visit action = func(current);
+            if (action == Visit::Stop)
+                return false;
+            if (action == Visit::Continue && arities_[current] != 0) {
+                stack.emplace_back(node, end);
+                node = first_children_[current];
+                end = node + arities_[current];
+            }
         }
-        return node;
     }
 
-    /// Stores parent nodes (ancestors) and evaluates the given function.
-    /// The function must be invocable with (iterator* begin, iterator* end)
-    template <typename Allocator = std::allocator<iterator>, typename Func>
-    static iterator ancestorsTraversal(iterator root, Func&& func, Allocator alloc = {})
+private:
+    std::size_t block_size_;
+    std::size_t nb_roots_ = 0;
+    std::vector<Arity> arities_;
+    std::vector<Payload> payloads_;
+    std::vector<std::uint32_t> first_children_;
+    std::vector<std::uint32_t> preorder_;  // position in the layout -> position in preorder
+    std::vector<std::uint32_t> positions_; // position in preorder -> position in the layout
+};
+
+/// Column of children counts encoded on `Bits` bits per node (2 or 4): the codes below
+/// 2^Bits - 1 are the children count itself, and the last code is an escape to a side table
+/// holding the larger counts. With 2 bits, trees whose nodes are mostly leaves and binary nodes
+/// take about 2.25 bits per node, instead of 8 to 64 bits for a dense column. The escapes before
+/// a node are counted with a sample every 8 words, and the popcount of at most 8 words.
+template <unsigned Bits = 2>
+class CompactArityColumn {
+public:
+    static_assert(Bits == 2 || Bits == 4, "CompactArityColumn: codes have 2 or 4 bits");
+
+    /// Largest children count stored in the code itself.
+    static constexpr std::size_t max_inline_arity = (std::size_t{1} << Bits) - 2;
+
+    /// Appends the children count of the next node in preorder.
+    /// Throws std::overflow_error if `arity` does not fit in 32 bits.
+    void push_back(std::size_t arity)
     {
-        static_assert(std::is_invocable_v<Func, iterator*, iterator*>,
-                      "Func must be invocable with (iterator*, iterator*)");
+        if (arity > std::numeric_limits<std::uint32_t>::max())
+            throw std::overflow_error("CompactArityColumn: too many children");
+        if (size_ % codes_per_rank == 0)
+            ranks_.push_back(escapes_.size());
+        if (size_ % codes_per_word == 0)
+            words_.push_back(0);
+        std::uint64_t code = arity;
+        if (arity > max_inline_arity) {
+            code = escape;
+            escapes_.push_back(static_cast<std::uint32_t>(arity));
+        }
+        words_.back() |= code << shift(size_);
+        ++size_;
+    }
 
-        std::vector<iterator, Allocator> ancestors(alloc);
-        ancestors.push_back(root);
-        func(ancestors.data(), ancestors.data() + ancestors.size());
+    void reserve(std::size_t size)
+    {
+        words_.reserve((size + codes_per_word - 1) / codes_per_word);
+        ranks_.reserve((size + codes_per_rank - 1) / codes_per_rank);
+    }
 
-        return recursiveTraversal(root, [&](iterator node, auto& self) {
-            ancestors.push_back(node);
-            func(ancestors.data(), ancestors.data() + ancestors.size());
-            auto next = recursiveTraversal(node, self);
-            ancestors.pop_back();
-            return next;
-        });
+    /// Removes all the nodes, but keeps the capacity.
+    void clear() noexcept
+    {
+        words_.clear();
+        ranks_.clear();
+        escapes_.clear();
+        size_ = 0;
     }
 
-    /// For each node, we evaluate the given function by passing the result of evaluation of its children.
-    /// Func must match the signature (iterator node, Value* begin, Value* end) -> Value
-    template <typename Value, typename Allocator = std::allocator<Value>, typename Func>
-    static std::pair<Value, iterator>
-    evaluationTraversal(iterator root, Func&& func, Allocator alloc = {})
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    /// Returns the number of nodes with more than `max_inline_arity` children.
+    std::size_t escapesCount() const noexcept { return escapes_.size(); }
+
+    /// Returns the number of bytes used by the encoded column, excluding unused capacity.
+    std::size_t memoryUsage() const noexcept
     {
-        static_assert(std::is_invocable_r_v<Value, Func, iterator, Value*, Value*>,
-                      "Func must match the signature (iterator, Value*, Value*) -> Value");
+        return words_.size() * sizeof(std::uint64_t) + ranks_.size() * sizeof(std::uint64_t) +
+               escapes_.size() * sizeof(std::uint32_t);
+    }
 
-        std::vector<Value, Allocator> values(alloc);
+    /// Returns the children count of the node at `index`.
+    std::size_t operator[](std::size_t index) const noexcept
+    {
+        std::size_t code = (words_[index / codes_per_word] >> shift(index)) & escape;
+        return code == escape ? escapes_[rank(index)] : code;
+    }
 
-        auto next = recursiveTraversal(root, [&](iterator node, auto& self) {
-            std::size_t begin_index = values.size();
-            auto next = recursiveTraversal(node, self);
-            auto ret = func(node, values.data() + begin_index, values.data() + values.size());
-            values.resize(begin_index);
-            values.emplace_back(ret);
-            return next;
-        });
+    /// Returns the index past the subtree whose root is at `index`. As in `jv::findSubtreeEnd`,
+    /// the nodes which cannot end the subtree are only summed, here a word at a time: the codes
+    /// are summed in parallel within the word, and each escape is replaced by its children count.
+    std::size_t findSubtreeEnd(std::size_t index) const noexcept
+    {
+        std::size_t escape_index = rank(index);
+        std::size_t remaining = 1;
+        do {
+            std::size_t code = (words_[index / codes_per_word] >> shift(index)) & escape;
+            remaining = remaining + (code == escape ? escapes_[escape_index++] : code) - 1;
+            ++index;
+            // while the rest of the word is in the subtree
+            for (std::size_t length = codes_per_word - index % codes_per_word;
+                 remaining >= length; length = codes_per_word) {
+                std::uint64_t codes = words_[index / codes_per_word] >> shift(index);
+                std::size_t sum = sumCodes(codes);
+                if (std::uint64_t escapes = escapeMask(codes)) {
+                    std::size_t nb_escapes = detail::popcount(escapes);
+                    sum -= escape * nb_escapes;
+                    for (std::size_t end = escape_index + nb_escapes; escape_index != end;)
+                        sum += escapes_[escape_index++];
+                }
+                index += length;
+                remaining = remaining + sum - length;
+            }
+        } while (remaining != 0);
+        return index;
+    }
 
-        return {func(root, values.data(), values.data() + values.size()), next};
+private:
+    static constexpr std::size_t codes_per_word = 64 / Bits;
+    static constexpr std::size_t words_per_rank = 8;
+    static constexpr std::size_t codes_per_rank = codes_per_word * words_per_rank;
+    static constexpr std::uint64_t escape = (std::uint64_t{1} << Bits) - 1;
+    // lowest bit of each code
+    static constexpr std::uint64_t low_bits = ~std::uint64_t{0} / escape;
+
+    static constexpr unsigned shift(std::size_t index) noexcept
+    {
+        return static_cast<unsigned>(Bits * (index % codes_per_word));
+    }
+
+    /// Returns the sum of the codes of a word, summing adjacent codes up to bytes.
+    static constexpr std::size_t sumCodes(std::uint64_t codes) noexcept
+    {
+        if constexpr (Bits == 2)
+            codes = (codes & 0x3333333333333333u) + ((codes >> 2) & 0x3333333333333333u);
+        codes = (codes & 0x0f0f0f0f0f0f0f0fu) + ((codes >> 4) & 0x0f0f0f0f0f0f0f0fu);
+        return static_cast<std::size_t>((codes * 0x0101010101010101u) >> 56);
+    }
+
+    /// Returns the lowest bit of each escape code in `codes`.
+    static constexpr std::uint64_t escapeMask(std::uint64_t codes) noexcept
+    {
+        std::uint64_t mask = codes;
+        for (unsigned bit = 1; bit != Bits; ++bit)
+            mask &= codes >> bit;
+        return mask & low_bits;
+    }
+
+    /// Returns the number of escapes before the node at `index`.
+    std::size_t rank(std::size_t index) const noexcept
+    {
+        std::size_t word = index / codes_per_word;
+        std::size_t rank = ranks_[index / codes_per_rank];
+        for (std::size_t i = word - word % words_per_rank; i != word; ++i)
+            rank += detail::popcount(escapeMask(words_[i]));
+        if (index % codes_per_word != 0) {
+            std::uint64_t before = (std::uint64_t{1} << shift(index)) - 1;
+            rank += detail::popcount(escapeMask(words_[word]) & before);
+        }
+        return rank;
+    }
+
+    std::vector<std::uint64_t> words_;   // codes from the low bits of each word
+    std::vector<std::uint64_t> ranks_;   // number of escapes before every 8th word
+    std::vector<std::uint32_t> escapes_; // children counts of the escaped nodes, in preorder
+    std::size_t size_ = 0;
+};
+
+/// Iterator over a CompactFlatTree, pointing to the payload of a node. Its children count is
+/// decoded from the compact column.
+template <typename Payload, unsigned Bits>
+class CompactFlatTreeIterator {
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = Payload;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Payload const*;
+    using reference = Payload const&;
+
+    CompactFlatTreeIterator() noexcept = default;
+    CompactFlatTreeIterator(CompactArityColumn<Bits> const* arities,
+                            Payload const* payloads,
+                            std::size_t index) noexcept
+        : arities_{arities}, payloads_{payloads}, index_{index}
+    {
+    }
+
+    /// Returns the number of children of the node.
+    std::size_t arity() const noexcept { return (*arities_)[index_]; }
+
+    /// Returns the position of the node in preorder.
+    std::size_t index() const noexcept { return index_; }
+
+    /// Returns an iterator past the subtree of the node.
+    CompactFlatTreeIterator subtreeEnd() const noexcept
+    {
+        return {arities_, payloads_, arities_->findSubtreeEnd(index_)};
+    }
+
+    reference operator*() const noexcept { return payloads_[index_]; }
+    pointer operator->() const noexcept { return payloads_ + index_; }
+    reference operator[](difference_type n) const noexcept { return payloads_[index_ + n]; }
+
+    CompactFlatTreeIterator& operator++() noexcept { return *this += 1; }
+    CompactFlatTreeIterator& operator--() noexcept { return *this -= 1; }
+    CompactFlatTreeIterator operator++(int) noexcept
+    {
+        return std::exchange(*this, *this + 1);
+    }
+    CompactFlatTreeIterator operator--(int) noexcept
+    {
+        return std::exchange(*this, *this - 1);
+    }
+
+    CompactFlatTreeIterator& operator+=(difference_type n) noexcept
+    {
+        index_ += n;
+        return *this;
+    }
+    CompactFlatTreeIterator& operator-=(difference_type n) noexcept { return *this += -n; }
+
+    friend CompactFlatTreeIterator operator+(CompactFlatTreeIterator it, difference_type n) noexcept
+    {
+        return it += n;
+    }
+    friend CompactFlatTreeIterator operator+(difference_type n, CompactFlatTreeIterator it) noexcept
+    {
+        return it += n;
+    }
+    friend CompactFlatTreeIterator operator-(CompactFlatTreeIterator it, difference_type n) noexcept
+    {
+        return it -= n;
+    }
+    friend difference_type operator-(CompactFlatTreeIterator lhs,
+                                     CompactFlatTreeIterator rhs) noexcept
+    {
+        return static_cast<difference_type>(lhs.index_ - rhs.index_);
+    }
+
+    friend bool operator==(CompactFlatTreeIterator lhs, CompactFlatTreeIterator rhs) noexcept
+    {
+        return lhs.index_ == rhs.index_;
+    }
+    friend bool operator!=(CompactFlatTreeIterator lhs, CompactFlatTreeIterator rhs) noexcept
+    {
+        return lhs.index_ != rhs.index_;
+    }
+    friend bool operator<(CompactFlatTreeIterator lhs, CompactFlatTreeIterator rhs) noexcept
+    {
+        return lhs.index_ < rhs.index_;
     }
+    friend bool operator>(CompactFlatTreeIterator lhs, CompactFlatTreeIterator rhs) noexcept
+    {
+        return lhs.index_ > rhs.index_;
+    }
+    friend bool operator<=(CompactFlatTreeIterator lhs, CompactFlatTreeIterator rhs) noexcept
+    {
+        return lhs.index_ <= rhs.index_;
+    }
+    friend bool operator>=(CompactFlatTreeIterator lhs, CompactFlatTreeIterator rhs) noexcept
+    {
+        return lhs.index_ >= rhs.index_;
+    }
+
+private:
+    CompactArityColumn<Bits> const* arities_ = nullptr;
+    Payload const* payloads_ = nullptr;
+    std::size_t index_ = 0;
+};
+
+/// NodeTraits of a CompactFlatTree, decoding children counts from the compact column.
+template <typename Payload, unsigned Bits>
+struct CompactFlatTreeTraits
+    : NodeTraits<CompactFlatTreeIterator<Payload, Bits>, CompactFlatTreeTraits<Payload, Bits>> {
+    using iterator = CompactFlatTreeIterator<Payload, Bits>;
+
+    static std::size_t getChildrenCount(iterator it) noexcept { return it.arity(); }
+
+    /// Iterates to the next sibling of the node, using `CompactArityColumn::findSubtreeEnd`.
+    static iterator getNextSibling(iterator node) noexcept { return node.subtreeEnd(); }
+};
+
+/// Tree stored in preorder as a FlatTree, but whose children counts are in a
+/// CompactArityColumn with codes of `Bits` bits. Use `CompactFlatTree::traits` to run algorithms
+/// on it.
+template <typename Payload, unsigned Bits = 2>
+class CompactFlatTree {
+public:
+    using traits = CompactFlatTreeTraits<Payload, Bits>;
+    using iterator = CompactFlatTreeIterator<Payload, Bits>;
+
+    CompactFlatTree() = default;
+
+    /// Copies the nodes of a flat tree.
+    template <typename Arity>
+    explicit CompactFlatTree(FlatTreeView<Payload, Arity> tree)
+    {
+        reserve(tree.size());
+        for (std::size_t i = 0; i != tree.size(); ++i)
+            push_back(tree.payload(i), tree.arities()[i]);
+    }
+
+    /// Appends a node in preorder. Throws std::overflow_error if `arity` does not fit in 32 bits.
+    void push_back(Payload payload, std::size_t arity)
+    {
+        arities_.push_back(arity);
+        payloads_.push_back(std::move(payload));
+    }
+
+    void reserve(std::size_t size)
+    {
+        arities_.reserve(size);
+        payloads_.reserve(size);
+    }
+
+    /// Removes all the nodes, but keeps the capacity.
+    void clear() noexcept
+    {
+        arities_.clear();
+        payloads_.clear();
+    }
+
+    std::size_t size() const noexcept { return arities_.size(); }
+    bool empty() const noexcept { return arities_.empty(); }
+
+    iterator begin() const noexcept { return {&arities_, payloads_.data(), 0}; }
+    iterator end() const noexcept { return begin() + size(); }
+
+    /// The encoded children counts, in preorder.
+    CompactArityColumn<Bits> const& arities() const noexcept { return arities_; }
+
+    /// The payload of each node, in preorder.
+    std::vector<Payload> const& payloads() const noexcept { return payloads_; }
+
+    /// Returns the payload of the node at position `index`.
+    /// Payloads can be modified, but not the structure of the tree.
+    Payload& payload(std::size_t index) noexcept { return payloads_[index]; }
+    Payload const& payload(std::size_t index) const noexcept { return payloads_[index]; }
+
+private:
+    CompactArityColumn<Bits> arities_;
+    std::vector<Payload> payloads_;
 };
 
 } // namespace jv
@@ -1,3 +1,5 @@
 
 #define CATCH_CONFIG_MAIN
+// the alternate signal stack of Catch does not compile with recent glibc
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
 #include "catch.hpp"
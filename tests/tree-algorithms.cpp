@@ -1,12 +1,24 @@
 #include "catch.hpp"
+#include <jv/flat-tree-file.hpp>
 #include <jv/tree-algorithms.hpp>
 
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <sstream>
 #include <string>
 #include <string_view>
 #include <variant>
 #include <vector>
 
+#if __cplusplus >= 202002L
+#include <ranges>
+#endif
+
 using std::string;
 using std::string_view;
 
@@ -45,6 +57,25 @@ struct EntryTraits : jv::NodeTraits<Entries::const_iterator, EntryTraits> {
     }
 };
 
+// generates a balanced tree of directories, with `fanout` files at the lowest level
+void generate_entries(Entries& result, int fanout, int depth)
+{
+    if (depth == 0) {
+        result.push_back(File{"file", static_cast<int>(result.size())});
+        return;
+    }
+    result.push_back(Directory{"dir", fanout});
+    for (int i = 0; i < fanout; ++i)
+        generate_entries(result, fanout, depth - 1);
+}
+
+int sum_sizes(EntryTraits::iterator node, int* it, int* end)
+{
+    if (auto file = std::get_if<File>(&*node))
+        return file->size;
+    return std::accumulate(it, end, 0);
+}
+
 TEST_CASE("getNextSibling")
 {
     std::vector<string_view> result;
@@ -101,4 +132,1318 @@ TEST_CASE("evaluationTraversal")
 
     CHECK(next == entries.end());
     CHECK(value == 1500);
-}
\ No newline at end of file
+}
+
+TEST_CASE("iterativeTraversal")
+{
+    std::vector<string_view> pre, post;
+    auto next = EntryTraits::iterativeTraversal(
+        entries.begin(),
+        [&](auto node) { std::visit([&](auto& value) { pre.push_back(value.name); }, *node); },
+        [&](auto node) { std::visit([&](auto& value) { post.push_back(value.name); }, *node); });
+
+    CHECK(next == entries.end());
+    std::vector<string_view> expected_pre{"TreeAlgorithms", "README.md", "src", "jv",
+                                          "tree-algorithms.hpp", "main.cpp", "LICENSE"};
+    std::vector<string_view> expected_post{"README.md", "tree-algorithms.hpp", "jv", "main.cpp",
+                                           "src", "LICENSE", "TreeAlgorithms"};
+    CHECK(pre == expected_pre);
+    CHECK(post == expected_post);
+}
+
+TEST_CASE("iterative traversals match recursive ones")
+{
+    auto to_path = [](std::vector<string>& result) {
+        return [&result](auto it, auto end) {
+            std::string str;
+            for (; it != end; ++it)
+                std::visit([&](auto& value) { str += string(value.name) + "/"; }, **it);
+            result.emplace_back(std::move(str));
+        };
+    };
+    std::vector<string> recursive, iterative;
+    EntryTraits::ancestorsTraversal(entries.begin(), to_path(recursive));
+    auto next = EntryTraits::iterativeAncestorsTraversal(entries.begin(), to_path(iterative));
+    CHECK(next == entries.end());
+    CHECK(recursive == iterative);
+
+    auto sum_sizes = [](auto node, auto it, auto end) {
+        if (auto file = std::get_if<File>(&*node))
+            return file->size;
+        return std::accumulate(it, end, 0);
+    };
+    auto [value, value_next] =
+        EntryTraits::iterativeEvaluationTraversal<int>(entries.begin(), sum_sizes);
+    CHECK(value_next == entries.end());
+    CHECK(value == EntryTraits::evaluationTraversal<int>(entries.begin(), sum_sizes).first);
+}
+
+TEST_CASE("iterative traversals on a deep tree")
+{
+    // a chain of one million directories, too deep for recursive traversals
+    constexpr int depth = 1'000'000;
+    Entries chain(depth, Directory{"d", 1});
+    chain.push_back(File{"f", 42});
+
+    std::size_t max_depth = 0;
+    auto next = EntryTraits::iterativeAncestorsTraversal(chain.cbegin(), [&](auto it, auto end) {
+        max_depth = std::max<std::size_t>(max_depth, end - it);
+    });
+    CHECK(next == chain.cend());
+    CHECK(max_depth == depth + 1);
+
+    auto [value, value_next] = EntryTraits::iterativeEvaluationTraversal<int>(
+        chain.cbegin(), [](auto node, auto it, auto end) {
+            if (auto file = std::get_if<File>(&*node))
+                return file->size;
+            return std::accumulate(it, end, 1);
+        });
+    CHECK(value_next == chain.cend());
+    CHECK(value == 42 + depth);
+}
+
+TEST_CASE("SubtreeIndex")
+{
+    jv::SubtreeIndex<EntryTraits> index(entries.begin(), entries.end());
+
+    std::vector<std::uint32_t> expected_sizes{7, 1, 4, 2, 1, 1, 1};
+    CHECK(std::vector<std::uint32_t>(index.sizes(), index.sizes() + index.size()) ==
+          expected_sizes);
+
+    std::vector<string_view> children;
+    index.forEachChild(entries.begin(), [&](auto child) {
+        std::visit([&](auto& value) { children.push_back(value.name); }, *child);
+        CHECK(index.getNextSibling(child) == EntryTraits::getNextSibling(child));
+    });
+    std::vector<string_view> expected{"README.md", "src", "LICENSE"};
+    CHECK(children == expected);
+
+    CHECK(index.getSubtreeEnd(entries.begin()) == entries.end());
+    CHECK(index.getSubtreeSize(entries.begin() + 2) == 4);
+}
+
+TEST_CASE("parallelEvaluationTraversal")
+{
+    Entries tree;
+    generate_entries(tree, 5, 6);
+    auto expected = EntryTraits::evaluationTraversal<int>(tree.cbegin(), sum_sizes);
+
+    auto result = EntryTraits::parallelEvaluationTraversal<int>(tree.cbegin(), sum_sizes,
+                                                                jv::ThreadExecutor{4}, 16);
+    CHECK(result == expected);
+
+    jv::SubtreeIndex<EntryTraits> index(tree.cbegin(), tree.cend());
+    auto indexed = EntryTraits::parallelEvaluationTraversal<int>(tree.cbegin(), sum_sizes, index,
+                                                                 jv::ThreadExecutor{4}, 1000);
+    CHECK(indexed == expected);
+
+    // a tree too small to be split
+    auto small = EntryTraits::parallelEvaluationTraversal<int>(entries.begin() + 1, sum_sizes);
+    CHECK(small.first == 100);
+    CHECK(small.second == entries.begin() + 2);
+}
+
+TEST_CASE("compile")
+{
+    auto [program, next] = EntryTraits::compile(entries.begin());
+    CHECK(next == entries.end());
+    REQUIRE(program.instructions().size() == entries.size());
+    CHECK(program.instructions().back().payload == entries.begin()); // root is evaluated last
+    CHECK(program.stackSize() == 3);
+    CHECK(program.evaluate<int>(sum_sizes) == 1500);
+
+    // lowering to the size of files, evaluated with a caller-provided stack
+    auto [sizes, sizes_next] = EntryTraits::compile(entries.begin(), [](auto node) {
+        auto file = std::get_if<File>(&*node);
+        return file ? file->size : 0;
+    });
+    std::vector<int> stack(sizes.stackSize());
+    auto total = sizes.evaluate<int>(
+        [](int size, int* it, int* end) { return std::accumulate(it, end, size); },
+        stack.data());
+    CHECK(total == 1500);
+}
+
+TEST_CASE("batchEvaluationTraversal")
+{
+    using Pack = jv::Lanes<int, 8>;
+    std::vector<int> result;
+
+    // evaluates the total size when all files are scaled by the input index
+    auto [out, next] = EntryTraits::batchEvaluationTraversal<int, 8>(
+        entries.begin(), 20,
+        [](auto node, std::size_t first_input, Pack* it, Pack* end) {
+            if (auto file = std::get_if<File>(&*node)) {
+                Pack scale{};
+                for (std::size_t i = 0; i != Pack::size; ++i)
+                    scale[i] = static_cast<int>(first_input + i);
+                return Pack::broadcast(file->size) * scale;
+            }
+            return std::accumulate(it, end, Pack::broadcast(0));
+        },
+        std::back_inserter(result));
+
+    CHECK(next == entries.end());
+    REQUIRE(result.size() == 20);
+    for (int i = 0; i < 20; ++i)
+        CHECK(result[i] == 1500 * i);
+}
+
+TEST_CASE("Workspace")
+{
+    CHECK(EntryTraits::getDepth(entries.begin()) == 4);
+    CHECK(EntryTraits::getDepth(entries.begin() + 1) == 1);
+
+    EntryTraits::Workspace<int> values;
+    values.reserve(EntryTraits::getDepth(entries.begin()), 8);
+    auto capacity = values.stack.capacity();
+    auto data = values.stack.data();
+    for (int i = 0; i < 3; ++i) {
+        CHECK(EntryTraits::evaluationTraversal<int>(entries.begin(), sum_sizes, values).first ==
+              1500);
+        CHECK(EntryTraits::iterativeEvaluationTraversal<int>(entries.begin(), sum_sizes, values)
+                  .first == 1500);
+    }
+    CHECK(values.stack.capacity() == capacity);
+    CHECK(values.stack.data() == data); // no reallocation occurred
+
+    EntryTraits::Workspace<EntryTraits::iterator> ancestors;
+    std::size_t nb_calls = 0;
+    auto count_calls = [&](auto, auto) { ++nb_calls; };
+    EntryTraits::ancestorsTraversal(entries.begin(), count_calls, ancestors);
+    EntryTraits::iterativeAncestorsTraversal(entries.begin(), count_calls, ancestors);
+    CHECK(nb_calls == 2 * entries.size());
+    CHECK(ancestors.stack.capacity() >= 4);
+}
+
+TEST_CASE("StackArena")
+{
+    jv::StackArena arena(64);
+    void* first = arena.allocate(16, 8);
+    void* second = arena.allocate(16, 8);
+    arena.deallocate(second, 16); // last allocation is reclaimed
+    CHECK(arena.allocate(16, 8) == second);
+    CHECK(reinterpret_cast<std::uintptr_t>(arena.allocate(1, 64)) % 64 == 0);
+    arena.allocate(1000, 8); // does not fit in the first block
+    arena.reset();
+    (void)first;
+
+    jv::InlineArena<64 * sizeof(int)> inline_arena;
+    auto [value, next] = EntryTraits::iterativeEvaluationTraversal<int>(
+        entries.begin(), sum_sizes, jv::ArenaAllocator<int>(inline_arena));
+    CHECK(value == 1500);
+    CHECK(next == entries.end());
+
+    for (int i = 0; i < 3; ++i) {
+        arena.reset();
+        CHECK(EntryTraits::evaluationTraversal<int>(entries.begin(), sum_sizes,
+                                                    jv::ArenaAllocator<int>(arena))
+                  .first == 1500);
+    }
+}
+
+struct PointerEntry {
+    string_view name;
+    int size = 0; // only for files
+    std::vector<std::unique_ptr<PointerEntry>> children;
+};
+
+TEST_CASE("flatten and unflatten")
+{
+    auto make = [](string_view name, int size) {
+        auto entry = std::make_unique<PointerEntry>();
+        entry->name = name;
+        entry->size = size;
+        return entry;
+    };
+    auto src = make("src", 0), jv = make("jv", 0);
+    jv->children.push_back(make("tree-algorithms.hpp", 800));
+    src->children.push_back(std::move(jv));
+    src->children.push_back(make("main.cpp", 400));
+    auto root = make("TreeAlgorithms", 0);
+    root->children.push_back(make("README.md", 100));
+    root->children.push_back(std::move(src));
+    root->children.push_back(make("LICENSE", 200));
+
+    Entries flat = jv::flatten(
+        root, [](auto const& entry) -> auto& { return entry->children; },
+        [](auto const& entry, std::size_t nb_children) -> Entry {
+            if (nb_children == 0)
+                return File{entry->name, entry->size};
+            return Directory{entry->name, static_cast<int>(nb_children)};
+        },
+        entries.size());
+
+    REQUIRE(flat.size() == entries.size());
+    for (std::size_t i = 0; i < flat.size(); ++i)
+        CHECK(EntryTraits::getChildrenCount(flat.cbegin() + i) ==
+              EntryTraits::getChildrenCount(entries.cbegin() + i));
+    CHECK(EntryTraits::evaluationTraversal<int>(flat.cbegin(), sum_sizes).first == 1500);
+
+    auto links = EntryTraits::unflatten(entries.begin(), entries.end());
+    auto npos = jv::TreeLinks::npos;
+    std::vector<std::size_t> expected_parents{npos, 0, 0, 2, 3, 2, 0};
+    std::vector<std::size_t> expected_offsets{0, 3, 3, 5, 6, 6, 6, 6};
+    std::vector<std::size_t> expected_children{1, 2, 6, 3, 5, 4};
+    CHECK(links.parents == expected_parents);
+    CHECK(links.child_offsets == expected_offsets);
+    CHECK(links.children == expected_children);
+}
+
+TEST_CASE("FlatTree")
+{
+    // same tree as entries, with the size of files as payload
+    jv::FlatTree<int, std::uint8_t> tree;
+    for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+        auto file = std::get_if<File>(&*it);
+        tree.push_back(file ? file->size : 0, EntryTraits::getChildrenCount(it));
+    }
+    using Traits = decltype(tree)::traits;
+    REQUIRE(tree.size() == entries.size());
+    CHECK_THROWS_AS(tree.push_back(0, 256), std::overflow_error);
+
+    std::vector<std::uint8_t> expected_arities{3, 0, 2, 1, 0, 0, 0};
+    CHECK(tree.arities() == expected_arities);
+    CHECK(Traits::getNextSibling(tree.begin() + 2) == tree.begin() + 6);
+    CHECK(Traits::getDepth(tree.begin()) == 4);
+    CHECK(jv::SubtreeIndex<Traits>(tree.begin(), tree.end()).getSubtreeSize(tree.begin() + 2) == 4);
+
+    auto sum = [](auto node, int* it, int* end) { return std::accumulate(it, end, *node); };
+    auto [value, next] = Traits::iterativeEvaluationTraversal<int>(tree.begin(), sum);
+    CHECK(value == 1500);
+    CHECK(next == tree.end());
+
+    tree.payload(1) = 200; // README.md is now bigger
+    CHECK(Traits::evaluationTraversal<int>(tree.begin(), sum).first == 1600);
+}
+
+TEST_CASE("findSubtreeEnd")
+{
+    // a root with 100 children, the first one having 40 children
+    std::vector<std::uint16_t> arities(141, 0);
+    arities[0] = 100;
+    arities[1] = 40;
+    auto generic_end = [&](std::size_t i) {
+        std::size_t remaining = 1;
+        do
+            remaining = remaining + arities[i++] - 1;
+        while (remaining > 0);
+        return i;
+    };
+    for (std::size_t i = 0; i < arities.size(); ++i)
+        CHECK(jv::findSubtreeEnd(arities.data() + i) == arities.data() + generic_end(i));
+    CHECK(jv::findSubtreeEnd(arities.data()) == arities.data() + arities.size());
+    CHECK(jv::findSubtreeEnd(arities.data() + 1) == arities.data() + 42);
+}
+
+// expressions in polish notation, where digits are leaves and '~' is the negation
+struct ExpressionTraits : jv::NodeTraits<string_view::const_iterator, ExpressionTraits> {
+    static constexpr std::size_t maxChildren = 2;
+
+    static std::size_t getChildrenCount(iterator it) noexcept
+    {
+        return *it == '~' ? 1 : (*it == '+' || *it == '-' || *it == '*') ? 2 : 0;
+    }
+};
+
+int evaluate_expression(ExpressionTraits::iterator node, int* it, [[maybe_unused]] int* end)
+{
+    REQUIRE(end - it == static_cast<std::ptrdiff_t>(ExpressionTraits::getChildrenCount(node)));
+    switch (*node) {
+    case '~': return -it[0];
+    case '+': return it[0] + it[1];
+    case '-': return it[0] - it[1];
+    case '*': return it[0] * it[1];
+    default: return *node - '0';
+    }
+}
+
+TEST_CASE("boundedEvaluationTraversal")
+{
+    using Traits = ExpressionTraits;
+
+    // (2 * 3) - (-(4 + 1)) = 11
+    string_view expression = "-*23~+41";
+    auto [value, next] =
+        Traits::boundedEvaluationTraversal<int, 4>(expression.begin(), evaluate_expression);
+    CHECK(value == 11);
+    CHECK(next == expression.end());
+    CHECK_THROWS_AS((Traits::boundedEvaluationTraversal<int, 3>(expression.begin(),
+                                                                evaluate_expression)),
+                    std::length_error);
+
+    // the child loops of recursiveTraversal are unrolled
+    CHECK(Traits::evaluationTraversal<int>(expression.begin(), evaluate_expression) ==
+          std::pair{11, expression.end()});
+
+    string_view leaf = "7";
+    CHECK(Traits::boundedEvaluationTraversal<int, 1>(leaf.begin(), evaluate_expression).first == 7);
+
+    // right-leaning chain of depth 6
+    string_view chain = "+1+2+3+4+56";
+    CHECK(Traits::boundedEvaluationTraversal<int, 6>(chain.begin(), evaluate_expression).first ==
+          21);
+    CHECK_THROWS_AS(
+        (Traits::boundedEvaluationTraversal<int, 5>(chain.begin(), evaluate_expression)),
+        std::length_error);
+}
+
+TEST_CASE("visitTraversal")
+{
+    auto name = [](auto node) { return std::visit([](auto& value) { return value.name; }, *node); };
+
+    // finding the first file larger than 300 stops on tree-algorithms.hpp
+    std::vector<string_view> visited;
+    auto found = EntryTraits::visitTraversal(entries.begin(), [&](auto node) {
+        visited.push_back(name(node));
+        auto file = std::get_if<File>(&*node);
+        return file && file->size > 300 ? jv::Visit::Stop : jv::Visit::Continue;
+    });
+    CHECK(found == entries.begin() + 4);
+    CHECK(visited.size() == 5);
+
+    // skipping src
+    jv::SubtreeIndex<EntryTraits> index(entries.begin(), entries.end());
+    auto skip_src = [&](auto node) {
+        visited.push_back(name(node));
+        return name(node) == "src" ? jv::Visit::SkipSubtree : jv::Visit::Continue;
+    };
+    std::vector<string_view> expected{"TreeAlgorithms", "README.md", "src", "LICENSE"};
+    visited.clear();
+    CHECK(EntryTraits::visitTraversal(entries.begin(), skip_src) == entries.end());
+    CHECK(visited == expected);
+    visited.clear();
+    CHECK(EntryTraits::visitTraversal(entries.begin(), skip_src, index) == entries.end());
+    CHECK(visited == expected);
+
+    // skipping the root
+    visited.clear();
+    auto skip_all = [&](auto node) {
+        visited.push_back(name(node));
+        return jv::Visit::SkipSubtree;
+    };
+    CHECK(EntryTraits::visitTraversal(entries.begin(), skip_all) == entries.end());
+    CHECK(visited.size() == 1);
+}
+
+TEST_CASE("ancestorsTraversal with pruning")
+{
+    // paths of the entries outside of src, until LICENSE
+    std::vector<string> result;
+    auto build_paths = [&](auto it, auto end) {
+        std::string str;
+        for (; it != end; ++it)
+            std::visit([&](auto& value) { str += std::string(value.name) + "/"; }, **it);
+        result.push_back(str);
+        if (str == "TreeAlgorithms/src/")
+            return jv::Visit::SkipSubtree;
+        if (str == "TreeAlgorithms/LICENSE/")
+            return jv::Visit::Stop;
+        return jv::Visit::Continue;
+    };
+    std::vector<string> expected{"TreeAlgorithms/", "TreeAlgorithms/README.md/",
+                                 "TreeAlgorithms/src/", "TreeAlgorithms/LICENSE/"};
+
+    CHECK(EntryTraits::ancestorsTraversal(entries.begin(), build_paths) == entries.begin() + 6);
+    CHECK(result == expected);
+    result.clear();
+    CHECK(EntryTraits::iterativeAncestorsTraversal(entries.begin(), build_paths) ==
+          entries.begin() + 6);
+    CHECK(result == expected);
+}
+
+TEST_CASE("EvaluationCache")
+{
+    Entries tree = entries;
+    jv::EvaluationCache<EntryTraits, int> cache(tree.cbegin(), tree.cend(), sum_sizes);
+    std::vector<int> expected_values{1500, 100, 1200, 800, 800, 400, 200};
+    CHECK(cache.values() == expected_values);
+    CHECK(cache.getValue(tree.cbegin() + 2) == 1200);
+
+    // main.cpp grows, README.md is not recomputed
+    std::get<File>(tree[5]).size = 500;
+    std::size_t nb_calls = 0;
+    auto counted_sum = [&](auto node, int* it, int* end) {
+        ++nb_calls;
+        return sum_sizes(node, it, end);
+    };
+    cache.update(tree.cbegin() + 5, counted_sum);
+    CHECK(cache.getValue(tree.cbegin()) == 1600);
+    CHECK(nb_calls == 3); // main.cpp, src and TreeAlgorithms
+
+    // batched edits share the recomputation of src and TreeAlgorithms
+    std::get<File>(tree[4]).size = 0;
+    std::get<File>(tree[5]).size = 0;
+    std::get<File>(tree[6]).size = 0;
+    std::vector<EntryTraits::iterator> modified{tree.cbegin() + 4, tree.cbegin() + 6,
+                                                tree.cbegin() + 5};
+    nb_calls = 0;
+    cache.update(modified.begin(), modified.end(), counted_sum);
+    CHECK(nb_calls == 6);
+    expected_values = {100, 100, 0, 0, 0, 0, 0};
+    CHECK(cache.values() == expected_values);
+
+    // random edits of a large tree match a full evaluation
+    Entries large;
+    generate_entries(large, 4, 6);
+    jv::EvaluationCache<EntryTraits, int> large_cache(large.cbegin(), large.cend(), sum_sizes);
+    modified.clear();
+    for (std::size_t i = 0; i < large.size(); i += 97)
+        if (auto file = std::get_if<File>(&large[i])) {
+            file->size = -file->size;
+            modified.push_back(large.cbegin() + i);
+        }
+    REQUIRE(!modified.empty());
+    large_cache.update(modified.begin(), modified.end(), sum_sizes);
+    for (std::size_t i = 0; i < large.size(); ++i)
+        CHECK(large_cache.values()[i] ==
+              EntryTraits::evaluationTraversal<int>(large.cbegin() + i, sum_sizes).first);
+}
+
+TEST_CASE("views")
+{
+    auto name = [](auto node) { return std::visit([](auto& value) { return value.name; }, *node); };
+    auto names = [&](auto&& range) {
+        std::vector<string_view> result;
+        for (auto node : range)
+            result.push_back(name(node));
+        return result;
+    };
+    auto root = entries.cbegin(), src = root + 2;
+    jv::SubtreeIndex<EntryTraits> index(entries.begin(), entries.end());
+
+    std::vector<string_view> expected{"README.md", "src", "LICENSE"};
+    CHECK(names(EntryTraits::children(root)) == expected);
+    CHECK(names(EntryTraits::children(root, &index)) == expected);
+    CHECK(EntryTraits::children(root).size() == 3);
+    CHECK(EntryTraits::children(root + 1).empty());
+
+    expected = {"src", "jv", "tree-algorithms.hpp", "main.cpp"};
+    CHECK(names(EntryTraits::preorder(src)) == expected);
+
+    expected = {"tree-algorithms.hpp", "jv", "main.cpp", "src"};
+    CHECK(names(EntryTraits::postorder(src)) == expected);
+    auto postorder = EntryTraits::postorder(root);
+    CHECK(std::distance(postorder.begin(), postorder.end()) == 7);
+    CHECK(postorder.base() == entries.end());
+
+    expected = {"TreeAlgorithms", "src", "jv", "tree-algorithms.hpp"};
+    CHECK(names(EntryTraits::ancestors(root, root + 4)) == expected);
+    CHECK(names(EntryTraits::ancestors(root, root + 4, &index)) == expected);
+    expected = {"TreeAlgorithms"};
+    CHECK(names(EntryTraits::ancestors(root, root)) == expected);
+
+    // sum of the sizes of the leaves under src, without intermediate containers
+    auto leaves = EntryTraits::leaves(src);
+    int total = std::accumulate(leaves.begin(), leaves.end(), 0, [](int sum, auto node) {
+        return sum + std::get<File>(*node).size;
+    });
+    CHECK(total == 1200);
+    expected = {"README.md", "tree-algorithms.hpp", "main.cpp", "LICENSE"};
+    CHECK(names(EntryTraits::leaves(root)) == expected);
+    CHECK(names(EntryTraits::leaves(root + 1)) == std::vector<string_view>{"README.md"});
+
+#if __cplusplus >= 202002L
+    static_assert(std::ranges::forward_range<jv::ChildrenView<EntryTraits>>);
+    static_assert(std::ranges::forward_range<jv::PreorderView<EntryTraits>>);
+    static_assert(std::ranges::forward_range<jv::LeavesView<EntryTraits>>);
+    static_assert(std::ranges::forward_range<jv::AncestorsView<EntryTraits>>);
+    static_assert(std::ranges::input_range<jv::PostorderView<EntryTraits>>);
+    auto files = EntryTraits::preorder(root) | std::views::filter([](auto node) {
+                     return std::holds_alternative<File>(*node);
+                 });
+    CHECK(std::ranges::distance(files) == 4);
+#endif
+}
+
+// entry read from a text stream, as "name nb_children size"
+struct StreamedEntry {
+    string name;
+    std::size_t nb_children = 0;
+    int size = 0;
+
+    friend std::istream& operator>>(std::istream& stream, StreamedEntry& entry)
+    {
+        return stream >> entry.name >> entry.nb_children >> entry.size;
+    }
+};
+
+struct StreamTraits : jv::NodeTraits<std::istream_iterator<StreamedEntry>, StreamTraits> {
+    static std::size_t getChildrenCount(iterator it) noexcept { return it->nb_children; }
+};
+
+TEST_CASE("stream traversals")
+{
+    // two trees, the first one being the same as `entries`
+    string text = "TreeAlgorithms 3 0  README.md 0 100  src 2 0  jv 1 0  tree-algorithms.hpp 0 800 "
+                  "main.cpp 0 400  LICENSE 0 200  "
+                  "other 1 0  file 0 50";
+    auto sum = [](StreamedEntry const& entry, int* it, int* end) {
+        return std::accumulate(it, end, entry.size);
+    };
+
+    std::istringstream values_stream(text);
+    auto [value, next] = StreamTraits::streamEvaluationTraversal<int>(
+        std::istream_iterator<StreamedEntry>(values_stream), sum);
+    CHECK(value == 1500);
+    CHECK(next->name == "other"); // the second tree can be evaluated from `next`
+    auto [other, end] = StreamTraits::streamEvaluationTraversal<int>(next, sum);
+    CHECK(other == 50);
+    CHECK(end == std::istream_iterator<StreamedEntry>());
+
+    std::istringstream paths_stream(text);
+    std::vector<string> paths;
+    StreamTraits::streamAncestorsTraversal(
+        std::istream_iterator<StreamedEntry>(paths_stream),
+        [&](StreamedEntry const* it, StreamedEntry const* last) {
+            string path;
+            for (; it != last; ++it)
+                path += "/" + it->name;
+            paths.push_back(path);
+        });
+    std::vector<string> expected{"/TreeAlgorithms",
+                                 "/TreeAlgorithms/README.md",
+                                 "/TreeAlgorithms/src",
+                                 "/TreeAlgorithms/src/jv",
+                                 "/TreeAlgorithms/src/jv/tree-algorithms.hpp",
+                                 "/TreeAlgorithms/src/main.cpp",
+                                 "/TreeAlgorithms/LICENSE"};
+    CHECK(paths == expected);
+}
+
+TEST_CASE("MappedFlatTree")
+{
+    jv::FlatTree<int, std::uint16_t> tree;
+    for (auto it = entries.cbegin(); it != entries.cend(); ++it) {
+        auto file = std::get_if<File>(&*it);
+        tree.push_back(file ? file->size : 0, EntryTraits::getChildrenCount(it));
+    }
+    auto sum = [](auto node, int* it, int* end) { return std::accumulate(it, end, *node); };
+    string path = "mapped-flat-tree.bin", no_index_path = "mapped-flat-tree-no-index.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        jv::writeFlatTree(out, tree.view());
+        std::ofstream no_index_out(no_index_path, std::ios::binary);
+        jv::writeFlatTree(no_index_out, tree.view(), false);
+    }
+
+    {
+        jv::MappedFlatTree<int, std::uint16_t> mapped(path);
+        using Traits = decltype(mapped)::traits;
+        REQUIRE(mapped.size() == tree.size());
+        CHECK(std::equal(tree.arities().begin(), tree.arities().end(), mapped.view().arities()));
+        CHECK(mapped.view().payload(4) == 800);
+        CHECK(Traits::evaluationTraversal<int>(mapped.begin(), sum).first == 1500);
+
+        REQUIRE(mapped.index() != nullptr);
+        CHECK(mapped.index()->getSubtreeSize(mapped.begin() + 2) == 4);
+        CHECK(Traits::parallelEvaluationTraversal<int>(mapped.begin(), sum, *mapped.index(),
+                                                       jv::ThreadExecutor(2), 3)
+                  .first == 1500);
+
+        jv::MappedFlatTree<int, std::uint16_t> no_index(no_index_path);
+        CHECK(no_index.index() == nullptr);
+        CHECK(Traits::getDepth(no_index.begin()) == 4);
+    }
+
+    CHECK_THROWS_AS((jv::MappedFlatTree<int, std::uint32_t>(path)), std::runtime_error);
+    CHECK_THROWS_AS((jv::MappedFlatTree<int, std::uint16_t>("missing.bin")), std::system_error);
+    {
+        std::ofstream truncated(no_index_path, std::ios::binary);
+        truncated << "JVFLTREE";
+    }
+    CHECK_THROWS_AS((jv::MappedFlatTree<int, std::uint16_t>(no_index_path)), std::runtime_error);
+
+    // the last directory has one more child than there are nodes left
+    tree.push_back(0, 1);
+    {
+        std::ofstream out(no_index_path, std::ios::binary);
+        jv::writeFlatTree(out, tree.view(), false);
+    }
+    CHECK_THROWS_AS((jv::MappedFlatTree<int, std::uint16_t>(no_index_path)), std::runtime_error);
+    CHECK(jv::MappedFlatTree<int, std::uint16_t>(no_index_path, false).size() == 8);
+
+    // the size of the root does not match its subtree
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        jv::FlatTreeFileHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        std::uint32_t size = 3;
+        file.seekp(static_cast<std::streamoff>(header.sizes_offset));
+        file.write(reinterpret_cast<char const*>(&size), sizeof(size));
+    }
+    CHECK_THROWS_AS((jv::MappedFlatTree<int, std::uint16_t>(path)), std::runtime_error);
+
+    std::remove(path.c_str());
+    std::remove(no_index_path.c_str());
+}
+
+// counts its copies, to check that the traversals only move values
+struct CopyCounter {
+    static inline int nb_copies = 0;
+    int value = 0;
+
+    CopyCounter() = default;
+    CopyCounter(int v) : value{v} {}
+    CopyCounter(CopyCounter const& other) : value{other.value} { ++nb_copies; }
+    CopyCounter(CopyCounter&&) noexcept = default;
+    CopyCounter& operator=(CopyCounter const& other)
+    {
+        ++nb_copies;
+        value = other.value;
+        return *this;
+    }
+    CopyCounter& operator=(CopyCounter&&) noexcept = default;
+};
+
+TEST_CASE("inplaceEvaluationTraversal")
+{
+    auto name = [](auto node) { return std::visit([](auto& value) { return value.name; }, *node); };
+
+    // textual representation of each subtree
+    auto to_string = [&](auto node, string* it, string* end, string& result) {
+        result.clear();
+        result += name(node);
+        if (it != end) {
+            result += '(';
+            for (auto child = it; child != end; ++child)
+                result += (child != it ? "," : "") + *child;
+            result += ')';
+        }
+    };
+    string expected = "TreeAlgorithms(README.md,src(jv(tree-algorithms.hpp),main.cpp),LICENSE)";
+    EntryTraits::Workspace<string> workspace;
+    for (int i = 0; i < 2; ++i) {
+        auto [value, next] =
+            EntryTraits::inplaceEvaluationTraversal<string>(entries.begin(), to_string, workspace);
+        CHECK(value == expected);
+        CHECK(next == entries.end());
+    }
+    CHECK(workspace.stack.size() == 4); // slots are reused between the calls
+
+    auto [leaf, leaf_next] = EntryTraits::inplaceEvaluationTraversal<string>(entries.begin() + 1,
+                                                                            to_string);
+    CHECK(leaf == "README.md");
+    CHECK(leaf_next == entries.begin() + 2);
+
+    // the values are moved, never copied
+    auto sum = [](auto node, CopyCounter* it, CopyCounter* end) {
+        if (auto file = std::get_if<File>(&*node))
+            return CopyCounter(file->size);
+        int total = 0;
+        for (; it != end; ++it)
+            total += it->value;
+        return CopyCounter(total);
+    };
+    CopyCounter::nb_copies = 0;
+    CHECK(EntryTraits::evaluationTraversal<CopyCounter>(entries.begin(), sum).first.value == 1500);
+    CHECK(EntryTraits::inplaceEvaluationTraversal<CopyCounter>(
+              entries.begin(),
+              [&](auto node, CopyCounter* it, CopyCounter* end, CopyCounter& result) {
+                  result = sum(node, it, end);
+              })
+              .first.value == 1500);
+    CHECK(CopyCounter::nb_copies == 0);
+}
+
+TEST_CASE("forestEvaluationTraversal")
+{
+    // independent trees back to back: balanced trees of various sizes, and single files
+    Entries forest;
+    std::vector<int> expected;
+    for (int i = 0; i < 200; ++i) {
+        std::size_t first = forest.size();
+        generate_entries(forest, 1 + i % 4, i % 3);
+        expected.push_back(EntryTraits::evaluationTraversal<int>(forest.cbegin() + first, sum_sizes)
+                               .first);
+    }
+
+    std::vector<int> result;
+    EntryTraits::forestEvaluationTraversal<int>(forest.cbegin(), forest.cend(), sum_sizes,
+                                                std::back_inserter(result));
+    CHECK(result == expected);
+
+    std::vector<int> parallel(expected.size());
+    for (std::size_t min_tasks : {1, 7, 1000}) {
+        auto parallel_end = EntryTraits::parallelForestEvaluationTraversal<int>(
+            forest.cbegin(), forest.cend(), sum_sizes, parallel.begin(), jv::ThreadExecutor(3),
+            min_tasks);
+        CHECK(parallel_end == parallel.end());
+        CHECK(parallel == expected);
+    }
+
+    result.clear();
+    EntryTraits::forestEvaluationTraversal<int>(forest.cbegin(), forest.cbegin(), sum_sizes,
+                                                std::back_inserter(result));
+    EntryTraits::parallelForestEvaluationTraversal<int>(forest.cbegin(), forest.cbegin(), sum_sizes,
+                                                        std::back_inserter(result));
+    CHECK(result.empty());
+}
+
+TEST_CASE("fillDepthsAndParents")
+{
+    // random trees, a wide tree, and a deep tree whose spine comes before the leaves
+    std::vector<std::uint8_t> arities;
+    std::mt19937 random(42);
+    for (int i = 0; i < 50; ++i) {
+        std::size_t remaining = 1;
+        for (; remaining != 0; --remaining) {
+            std::uint8_t arity = arities.size() > 100'000 ? 0 : random() % (remaining < 20 ? 5 : 2);
+            arities.push_back(arity);
+            remaining += arity;
+        }
+    }
+    arities.push_back(255);
+    arities.insert(arities.end(), 255, 0);
+    std::size_t spine = 1000;
+    for (std::size_t i = 0; i < spine; ++i)
+        arities.push_back(2);
+    arities.insert(arities.end(), spine + 1, 0);
+
+    jv::FlatTree<int, std::uint8_t> tree;
+    for (auto arity : arities)
+        tree.push_back(0, arity);
+    using Traits = decltype(tree)::traits;
+    constexpr std::uint32_t npos = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> expected_depths, expected_parents;
+    for (auto root = tree.begin(); root != tree.end();)
+        root = Traits::iterativeAncestorsTraversal(root, [&](auto begin, auto end) {
+            expected_depths.push_back(static_cast<std::uint32_t>(end - begin - 1));
+            expected_parents.push_back(end - begin == 1 ? npos : end[-2] - tree.begin());
+        });
+    REQUIRE(expected_depths.size() == arities.size());
+
+    std::vector<std::uint32_t> depths(arities.size()), parents(arities.size());
+    jv::fillDepthsAndParents(arities.data(), arities.size(), depths.data(), parents.data());
+    CHECK(depths == expected_depths);
+    CHECK(parents == expected_parents);
+
+    for (std::size_t min_tasks : {1, 3, 64, 5000, 1'000'000}) {
+        std::fill(depths.begin(), depths.end(), 0);
+        std::fill(parents.begin(), parents.end(), 0);
+        jv::parallelFillDepthsAndParents(arities.data(), arities.size(), depths.data(),
+                                         parents.data(), jv::ThreadExecutor(3), min_tasks);
+        CHECK(depths == expected_depths);
+        CHECK(parents == expected_parents);
+    }
+    jv::parallelFillDepthsAndParents(arities.data(), 0, depths.data(), parents.data());
+}
+
+TEST_CASE("propagationTraversal")
+{
+    // the paths of the ancestorsTraversal test, each built once from the path of its parent
+    std::vector<string> result;
+    auto next = EntryTraits::propagationTraversal(
+        entries.begin(), string{}, [&](auto node, string const& parent) {
+            string path = parent;
+            if (auto dir = std::get_if<Directory>(&*node))
+                path += std::string(dir->name) + "/";
+            else
+                path += std::string(std::get<File>(*node).name);
+            result.push_back(path);
+            return path;
+        });
+    CHECK(next == entries.end());
+    std::vector<string> expected{"TreeAlgorithms/",
+                                 "TreeAlgorithms/README.md",
+                                 "TreeAlgorithms/src/",
+                                 "TreeAlgorithms/src/jv/",
+                                 "TreeAlgorithms/src/jv/tree-algorithms.hpp",
+                                 "TreeAlgorithms/src/main.cpp",
+                                 "TreeAlgorithms/LICENSE"};
+    CHECK(result == expected);
+
+    // depths of a deep chain, with a workspace reused for an isolated leaf
+    std::size_t depth = 100'000;
+    Entries chain(depth, Directory{"dir", 1});
+    chain.push_back(File{"file", 1});
+    EntryTraits::Workspace<std::size_t> workspace;
+    std::size_t max_depth = 0;
+    auto add_depth = [&](auto, std::size_t parent_depth) {
+        max_depth = std::max(max_depth, parent_depth + 1);
+        return parent_depth + 1;
+    };
+    CHECK(EntryTraits::propagationTraversal(chain.cbegin(), std::size_t{0}, add_depth, workspace) ==
+          chain.cend());
+    CHECK(max_depth == depth + 1);
+    CHECK(workspace.frames.capacity() >= depth - 1);
+    CHECK(EntryTraits::propagationTraversal(chain.cend() - 1, std::size_t{0}, add_depth,
+                                            workspace) == chain.cend());
+}
+
+struct CountedTraits : jv::NodeTraits<Entries::const_iterator, CountedTraits> {
+    using Instrumentation = jv::CountingInstrumentation<CountedTraits>;
+
+    static std::size_t getChildrenCount(iterator it) noexcept
+    {
+        return EntryTraits::getChildrenCount(it);
+    }
+};
+
+TEST_CASE("instrumentation")
+{
+    static_assert(std::is_empty_v<EntryTraits::Instrumentation::Probe>);
+    auto& counters = CountedTraits::Instrumentation::counters();
+    counters.reset();
+
+    // the ancestors stack grows up to "TreeAlgorithms/src/jv/tree-algorithms.hpp"
+    CountedTraits::iterativeAncestorsTraversal(entries.cbegin(), [](auto, auto) {});
+    auto stats = counters.snapshot();
+    CHECK(stats.traversals == 1);
+    CHECK(stats.nodes == entries.size());
+    CHECK(stats.max_stack_depth == 4);
+    CHECK(stats.reallocations > 0);
+    CHECK(stats.sibling_scans == 0);
+
+    // reserved buffers do not grow, and skipping "src" scans its subtree
+    counters.reset();
+    CountedTraits::Workspace<CountedTraits::iterator> workspace;
+    workspace.reserve(4);
+    CountedTraits::iterativeAncestorsTraversal(
+        entries.cbegin(),
+        [](auto, auto end) {
+            auto dir = std::get_if<Directory>(&*end[-1]);
+            return dir && dir->name == "src" ? jv::Visit::SkipSubtree : jv::Visit::Continue;
+        },
+        workspace);
+    stats = counters.snapshot();
+    CHECK(stats.nodes == 4);
+    CHECK(stats.reallocations == 0);
+    CHECK(stats.sibling_scans == 1);
+    CHECK(stats.max_stack_depth == 2);
+
+    // the counts add up over traversals
+    CountedTraits::evaluationTraversal<int>(entries.cbegin(), sum_sizes);
+    CountedTraits::iterativeTraversal(
+        entries.cbegin(), [](auto) {}, [](auto) {});
+    stats = counters.snapshot();
+    CHECK(stats.traversals == 3);
+    CHECK(stats.nodes == 4 + 2 * entries.size());
+
+    // stream traversals are counted like the others, and each slice of a resumable one is
+    // counted as a traversal
+    counters.reset();
+    CountedTraits::streamEvaluationTraversal<int>(entries.cbegin(),
+                                                  [](auto const&, int*, int*) { return 0; });
+    auto resumable =
+        CountedTraits::resumableAncestorsTraversal(entries.cbegin(), [](auto, auto) {});
+    std::uint64_t nb_slices = 1;
+    for (; !resumable.resume(2); ++nb_slices)
+        ;
+    stats = counters.snapshot();
+    CHECK(stats.traversals == 1 + nb_slices);
+    CHECK(stats.nodes == 2 * entries.size());
+    CHECK(stats.max_stack_depth == 4);
+
+    std::vector<string> names;
+    stats.forEach([&](char const* name, std::uint64_t) { names.push_back(name); });
+    std::vector<string> expected{"traversals",    "nodes",           "sibling_scans",
+                                 "reallocations", "max_stack_depth", "elapsed_ns"};
+    CHECK(names == expected);
+    counters.reset();
+    CHECK(counters.snapshot().nodes == 0);
+}
+
+TEST_CASE("SubtreeDag")
+{
+    // (2*3 + 2*3) * (2*3 + 2*3), then 2*3 again as a second tree
+    string_view expression = "*+*23*23+*23*23*23";
+    auto node_hash = [](auto node) { return static_cast<std::uint64_t>(*node); };
+    auto node_equal = [](auto lhs, auto rhs) { return *lhs == *rhs; };
+    jv::SubtreeDag<ExpressionTraits> dag(expression.begin(), expression.end(), node_hash,
+                                         node_equal);
+    CHECK(dag.size() == 5); // 2, 3, 2*3, 2*3 + 2*3 and the root
+    REQUIRE(dag.roots().size() == 2);
+    CHECK(dag.getNode(dag.roots()[0]) == expression.begin());
+    CHECK(dag.roots()[1] == 2);
+    CHECK(dag.getNode(2) == expression.begin() + 2);
+    auto [children, children_end] = dag.getChildren(dag.roots()[0]);
+    REQUIRE(children_end - children == 2);
+    CHECK(children[0] == children[1]);
+
+    auto [hash, next] = ExpressionTraits::hashTraversal(expression.begin(), node_hash);
+    CHECK(next == expression.begin() + 15);
+    CHECK(hash == dag.getHash(dag.roots()[0]));
+    CHECK(ExpressionTraits::hashTraversal(expression.begin() + 2, node_hash).first ==
+          ExpressionTraits::hashTraversal(expression.begin() + 15, node_hash).first);
+    CHECK(ExpressionTraits::hashTraversal(expression.begin() + 1, node_hash).first !=
+          ExpressionTraits::hashTraversal(expression.begin() + 2, node_hash).first);
+
+    // each distinct subtree is evaluated once
+    int nb_calls = 0;
+    auto values = dag.evaluate<int>([&](auto node, int* it, int* end) {
+        ++nb_calls;
+        return evaluate_expression(node, it, end);
+    });
+    CHECK(nb_calls == 5);
+    CHECK(values[dag.roots()[0]] == 144);
+    CHECK(values[dag.roots()[1]] == 6);
+
+    // with colliding hashes, different subtrees are still distinguished
+    jv::SubtreeDag<ExpressionTraits> colliding(
+        expression.begin(), expression.end(), [](auto) { return std::uint64_t{0}; }, node_equal);
+    CHECK(colliding.size() == 5);
+    CHECK(colliding.evaluate<int>(evaluate_expression)[colliding.roots()[0]] == 144);
+}
+
+TEST_CASE("resumable traversals")
+{
+    std::vector<std::size_t> expected_depths, depths;
+    EntryTraits::iterativeAncestorsTraversal(
+        entries.cbegin(), [&](auto begin, auto end) { expected_depths.push_back(end - begin); });
+
+    // one node per slice, then the rest of the tree at once
+    auto traversal = EntryTraits::resumableAncestorsTraversal(
+        entries.cbegin(), [&](auto begin, auto end) { depths.push_back(end - begin); });
+    CHECK_FALSE(traversal.done());
+    CHECK_FALSE(traversal.resume(1));
+    CHECK(depths.size() == 1);
+    CHECK_FALSE(traversal.resume(3));
+    CHECK(depths.size() == 4);
+    CHECK(traversal.position() == entries.cbegin() + 4);
+    CHECK(traversal.depth() == 3);
+    CHECK(traversal.resume(100));
+    CHECK(traversal.done());
+    CHECK(traversal.position() == entries.cend());
+    CHECK(depths == expected_depths);
+    CHECK(traversal.resume(1)); // finished traversals do nothing
+    CHECK(depths.size() == expected_depths.size());
+
+    // the last node finishes the traversal, and pruning works across slices
+    auto pruned = EntryTraits::resumableAncestorsTraversal(entries.cbegin(), [](auto, auto end) {
+        auto dir = std::get_if<Directory>(&*end[-1]);
+        return dir && dir->name == "src" ? jv::Visit::SkipSubtree : jv::Visit::Continue;
+    });
+    CHECK_FALSE(pruned.resume(3));
+    CHECK(pruned.position() == entries.cbegin() + 6);
+    CHECK(pruned.resume(1));
+    auto stopped = EntryTraits::resumableAncestorsTraversal(
+        entries.cbegin(), [](auto begin, auto end) {
+            return end - begin == 4 ? jv::Visit::Stop : jv::Visit::Continue;
+        });
+    CHECK(stopped.resume(100));
+    CHECK(stopped.position() == entries.cbegin() + 4);
+
+    // evaluation slices, on a deep chain whose ancestors finish together
+    int nb_calls = 0;
+    auto evaluation = EntryTraits::resumableEvaluationTraversal<int>(
+        entries.cbegin(), [&](auto node, int* it, int* end) {
+            ++nb_calls;
+            return sum_sizes(node, it, end);
+        });
+    for (int slice = 1; !evaluation.resume(2); ++slice)
+        CHECK(nb_calls == 2 * slice);
+    CHECK(nb_calls == static_cast<int>(entries.size()));
+    CHECK(evaluation.value() == 1500);
+    CHECK(evaluation.position() == entries.cend());
+
+    Entries chain(1000, Directory{"dir", 1});
+    chain.push_back(File{"file", 7});
+    auto chain_evaluation =
+        EntryTraits::resumableEvaluationTraversal<int>(chain.cbegin(), sum_sizes);
+    std::size_t nb_slices = 0;
+    while (!chain_evaluation.resume(10))
+        ++nb_slices;
+    CHECK(nb_slices == 100);
+    CHECK(chain_evaluation.value() == 7);
+
+    auto leaf = EntryTraits::resumableEvaluationTraversal<int>(entries.cbegin() + 1, sum_sizes);
+    CHECK_FALSE(leaf.done());
+    CHECK(leaf.resume(1));
+    CHECK(leaf.value() == 100);
+    CHECK(leaf.position() == entries.cbegin() + 2);
+}
+
+TEST_CASE("BlockedLayout")
+{
+    // random trees of up to 4 children, whose payloads are their preorder positions
+    jv::FlatTree<int, std::uint8_t> tree;
+    std::mt19937 random(7);
+    for (int i = 0; i < 3; ++i) {
+        std::size_t remaining = 1;
+        for (; remaining != 0; --remaining) {
+            std::uint8_t arity = tree.size() > 5000 ? 0 : random() % (remaining < 10 ? 5 : 2);
+            tree.push_back(static_cast<int>(tree.size()), arity);
+            remaining += arity;
+        }
+    }
+    using Traits = decltype(tree)::traits;
+    jv::SubtreeIndex<Traits> index(tree.begin(), tree.end());
+    auto sum = [](auto node, int* it, int* end) { return std::accumulate(it, end, *node); };
+
+    for (std::size_t block_size : {1, 4, 256, 100'000}) {
+        jv::BlockedLayout<int, std::uint8_t> layout(tree.view(), block_size);
+        REQUIRE(layout.size() == tree.size());
+        CHECK(layout.rootsCount() == 3);
+        CHECK(layout.preorderIndex(0) == 0);
+
+        auto layout_sum = [&](std::size_t position, int* it, int* end) {
+            return std::accumulate(it, end, layout.payload(position));
+        };
+        for (std::size_t i = 0; i < tree.size(); ++i) {
+            std::size_t position = layout.position(i);
+            REQUIRE(layout.preorderIndex(position) == i);
+            REQUIRE(layout.payload(position) == static_cast<int>(i));
+            REQUIRE(layout.getChildrenCount(position) == tree.arities()[i]);
+
+            // the children are contiguous, and in the same order
+            std::size_t child = layout.getFirstChild(position);
+            index.forEachChild(tree.begin() + i, [&](auto node) {
+                REQUIRE(layout.preorderIndex(child++) == std::size_t(node - tree.begin()));
+            });
+
+            if (i % 97 == 0) {
+                auto expected = Traits::iterativeEvaluationTraversal<int>(tree.begin() + i, sum);
+                CHECK(layout.evaluate<int>(position, layout_sum) == expected.first);
+
+                // visiting the whole subtree follows the preorder
+                std::size_t next = i;
+                CHECK(layout.visit(position, [&](std::size_t node) {
+                    CHECK(layout.preorderIndex(node) == next++);
+                    return jv::Visit::Continue;
+                }));
+                CHECK(next == i + index.getSubtreeSize(tree.begin() + i));
+            }
+        }
+
+        // pruning the children of an inner node, then stopping on its second node
+        auto inner = std::find_if(tree.arities().begin(), tree.arities().end(),
+                                  [](std::uint8_t arity) { return arity >= 2; });
+        std::size_t position = layout.position(inner - tree.arities().begin());
+        std::size_t nb_visited = 0;
+        CHECK(layout.visit(position, [&](std::size_t) {
+            ++nb_visited;
+            return nb_visited == 1 ? jv::Visit::Continue : jv::Visit::SkipSubtree;
+        }));
+        CHECK(nb_visited == 1u + *inner);
+        nb_visited = 0;
+        CHECK_FALSE(layout.visit(position, [&](std::size_t) {
+            return ++nb_visited == 2 ? jv::Visit::Stop : jv::Visit::Continue;
+        }));
+        CHECK(nb_visited == 2);
+    }
+}
+
+TEST_CASE("CompactFlatTree")
+{
+    // mostly leaves and binary nodes, with a few wide nodes which are escaped
+    jv::FlatTree<int, std::uint32_t> tree;
+    std::mt19937 random(11);
+    for (int i = 0; i < 4; ++i) {
+        for (std::size_t remaining = 1; remaining != 0; --remaining) {
+            std::uint32_t arity = 0;
+            if (tree.size() < 20000) {
+                auto draw = random() % 100;
+                arity = draw < 50 ? 0 : draw < 60 ? 1 : draw < 97 ? 2 : draw < 99 ? 3 : 300;
+                if (remaining < 4) // grows until the size limit
+                    arity = std::max<std::uint32_t>(arity, 2);
+            }
+            tree.push_back(static_cast<int>(tree.size()), arity);
+            remaining += arity;
+        }
+    }
+    using FlatTraits = decltype(tree)::traits;
+    auto check = [&](auto const& compact, std::size_t max_inline_arity) {
+        REQUIRE(compact.size() == tree.size());
+        CHECK(compact.arities().escapesCount() ==
+              std::size_t(std::count_if(
+                  tree.arities().begin(), tree.arities().end(),
+                  [&](std::uint32_t arity) { return arity > max_inline_arity; })));
+        CHECK(compact.arities().memoryUsage() < tree.size());
+
+        using Traits = typename std::decay_t<decltype(compact)>::traits;
+        for (std::size_t i = 0; i < tree.size(); ++i) {
+            REQUIRE(Traits::getChildrenCount(compact.begin() + i) == tree.arities()[i]);
+            REQUIRE(Traits::getNextSibling(compact.begin() + i).index() ==
+                    std::size_t(FlatTraits::getNextSibling(tree.begin() + i) - tree.begin()));
+        }
+
+        // the traversals run on the compact tree as on any other, the sums of node indices
+        // overflow an int
+        auto sum = [](auto node, std::int64_t* it, std::int64_t* end) {
+            return std::accumulate(it, end, std::int64_t{*node});
+        };
+        jv::SubtreeIndex<Traits> index(compact.begin(), compact.end());
+        for (auto root = compact.begin(); root != compact.end();
+             root = index.getNextSibling(root)) {
+            auto [value, end] =
+                Traits::template iterativeEvaluationTraversal<std::int64_t>(root, sum);
+            auto expected =
+                FlatTraits::evaluationTraversal<std::int64_t>(tree.begin() + root.index(), sum);
+            CHECK(value == expected.first);
+            CHECK(end.index() == std::size_t(expected.second - tree.begin()));
+            CHECK(*root == *(tree.begin() + root.index()));
+        }
+    };
+    REQUIRE(tree.size() > 20000);
+    check(jv::CompactFlatTree<int>(tree.view()), 2);
+    check(jv::CompactFlatTree<int, 4>(tree.view()), 14);
+
+    jv::CompactArityColumn<> column;
+    CHECK_THROWS_AS(column.push_back(std::size_t{1} << 32), std::overflow_error);
+    column.push_back(0);
+    CHECK(column.findSubtreeEnd(0) == 1);
+}
+
+TEST_CASE("transformTraversal")
+{
+    auto name = [](EntryTraits::iterator node) {
+        return std::visit([](auto const& entry) { return entry.name; }, *node);
+    };
+    jv::FlatTree<string_view, std::uint8_t> inserted;
+    inserted.push_back("a.cpp", 0);
+    inserted.push_back("b.cpp", 0);
+
+    jv::FlatTree<string_view, std::uint8_t> out;
+    using Action = jv::Transform<string_view, std::uint8_t>;
+    auto end = EntryTraits::transformTraversal(entries.cbegin(), [&](auto node) {
+        if (name(node) == "README.md")
+            return Action::remove();
+        if (name(node) == "jv")
+            return Action::splice();
+        if (name(node) == "main.cpp")
+            return Action::insert(inserted.view());
+        if (name(node) == "LICENSE")
+            return Action::leaf("COPYING");
+        return Action::keep(name(node));
+    }, out);
+    CHECK(end == entries.cend());
+    std::vector<string_view> expected_names{
+        "TreeAlgorithms", "src", "tree-algorithms.hpp", "a.cpp", "b.cpp", "COPYING"};
+    std::vector<std::uint8_t> expected_arities{2, 3, 0, 0, 0, 0};
+    CHECK(out.payloads() == expected_names);
+    CHECK(out.arities() == expected_arities);
+
+    // the output is appended, and may contain several trees or none
+    EntryTraits::transformTraversal(entries.cbegin(), [](auto) { return Action::remove(); }, out);
+    CHECK(out.size() == 6);
+    EntryTraits::transformTraversal(entries.cbegin() + 2, [&](auto node) {
+        return node == entries.cbegin() + 2 ? Action::splice() : Action::keep(name(node));
+    }, out);
+    CHECK(out.size() == 9);
+    CHECK(out.arities()[6] == 1);
+    CHECK(out.payloads()[8] == "main.cpp");
+
+    // removing the subtrees of the multiples of 7 from a random tree, against a recursive copy
+    jv::FlatTree<int, std::uint16_t> tree;
+    std::mt19937 random(5);
+    for (std::size_t remaining = 1; remaining != 0; --remaining) {
+        std::uint16_t arity = tree.size() > 5000 ? 0 : random() % (remaining < 10 ? 5 : 3);
+        tree.push_back(static_cast<int>(tree.size()), arity);
+        remaining += arity;
+    }
+    using Traits = decltype(tree)::traits;
+    jv::FlatTree<int, std::uint16_t> filtered, expected;
+    Traits::transformTraversal(tree.begin(), [](auto node) {
+        return *node % 7 == 0 && *node != 0 ? jv::Transform<int, std::uint16_t>::remove()
+                                            : jv::Transform<int, std::uint16_t>::keep(*node);
+    }, filtered);
+    jv::SubtreeIndex<Traits> index(tree.begin(), tree.end());
+    auto copy = [&](auto node, auto& self) -> void {
+        std::size_t position = expected.size(), nb_children = 0;
+        expected.push_back(*node, 0);
+        index.forEachChild(node, [&](auto child) {
+            if (*child % 7 != 0) {
+                ++nb_children;
+                self(child, self);
+            }
+        });
+        expected.setArity(position, nb_children);
+    };
+    copy(tree.begin(), copy);
+    CHECK(filtered.arities() == expected.arities());
+    CHECK(filtered.payloads() == expected.payloads());
+
+    // splicing the children of a node with 200 children of 2 children each
+    jv::FlatTree<int, std::uint8_t> wide, spliced;
+    wide.push_back(0, 200);
+    for (int i = 0; i < 200; ++i) {
+        wide.push_back(1, 2);
+        wide.push_back(2, 0);
+        wide.push_back(2, 0);
+    }
+    auto splice_ones = [](auto node) {
+        return *node == 1 ? jv::Transform<int, std::uint8_t>::splice()
+                          : jv::Transform<int, std::uint8_t>::keep(*node);
+    };
+    using WideTraits = decltype(wide)::traits;
+    CHECK_THROWS_AS(WideTraits::transformTraversal(wide.begin(), splice_ones, spliced),
+                    std::overflow_error);
+
+    // appending many trees to the same output grows it geometrically
+    jv::FlatTree<int, std::uint8_t> appended;
+    std::size_t nb_reallocations = 0;
+    for (int i = 0; i < 1000; ++i) {
+        std::size_t capacity = appended.capacity();
+        WideTraits::transformTraversal(wide.begin() + 1, splice_ones, appended);
+        nb_reallocations += appended.capacity() != capacity;
+    }
+    CHECK(appended.size() == 2000);
+    CHECK(nb_reallocations <= 12);
+}
+
+TEST_CASE("AncestorIndex")
+{
+    jv::AncestorIndex<EntryTraits> small(entries.cbegin(), entries.cend());
+    auto at = [](std::size_t i) { return entries.cbegin() + i; };
+    CHECK(small.isAncestor(at(2), at(4)));
+    CHECK(small.isAncestor(at(2), at(2)));
+    CHECK_FALSE(small.isAncestor(at(2), at(6)));
+    CHECK_FALSE(small.isAncestor(at(4), at(2)));
+    CHECK(small.getLowestCommonAncestor(at(4), at(5)) == at(2));
+    CHECK(small.getLowestCommonAncestor(at(6), at(4)) == at(0));
+    CHECK(small.getLowestCommonAncestor(at(4), at(3)) == at(3));
+    CHECK(small.getAncestor(at(4), 2) == at(2));
+    CHECK(small.getAncestor(at(4), 0) == at(4));
+    CHECK(small.getAncestor(at(4), 4) == small.end());
+    CHECK(small.getParent(at(0)) == small.end());
+    CHECK(small.getDepth(at(4)) == 3);
+
+    // random forest, against climbing the parents recorded by an ancestors traversal
+    jv::FlatTree<int, std::uint8_t> tree;
+    std::mt19937 random(3);
+    for (int i = 0; i < 3; ++i) {
+        for (std::size_t remaining = 1; remaining != 0; --remaining) {
+            std::uint8_t arity = tree.size() > 3000 ? 0 : random() % (remaining < 10 ? 4 : 3);
+            tree.push_back(0, arity);
+            remaining += arity;
+        }
+    }
+    using Traits = decltype(tree)::traits;
+    jv::AncestorIndex<Traits> index(tree.begin(), tree.end());
+    REQUIRE(index.size() == tree.size());
+    std::vector<Traits::iterator> parents(tree.size(), tree.end());
+    for (auto root = tree.begin(); root != tree.end();) {
+        root = Traits::iterativeAncestorsTraversal(root, [&](auto begin, auto end) {
+            if (end - begin >= 2)
+                parents[end[-1] - tree.begin()] = end[-2];
+        });
+    }
+    auto naive_ancestors = [&](auto node) {
+        std::vector<decltype(node)> ancestors{node};
+        while (parents[ancestors.back() - tree.begin()] != tree.end())
+            ancestors.push_back(parents[ancestors.back() - tree.begin()]);
+        std::reverse(ancestors.begin(), ancestors.end());
+        return ancestors; // from the root
+    };
+    for (int i = 0; i < 2000; ++i) {
+        auto a = tree.begin() + random() % tree.size();
+        auto b = i % 10 == 0 ? a + random() % std::min<std::size_t>(tree.end() - a, 40)
+                             : tree.begin() + random() % tree.size();
+        auto path_a = naive_ancestors(a), path_b = naive_ancestors(b);
+        REQUIRE(index.getDepth(a) == path_a.size() - 1);
+        REQUIRE(index.getParent(a) ==
+                (path_a.size() > 1 ? path_a[path_a.size() - 2] : index.end()));
+
+        auto expected = index.end();
+        for (std::size_t d = 0; d < std::min(path_a.size(), path_b.size()); ++d) {
+            if (path_a[d] == path_b[d])
+                expected = path_a[d];
+        }
+        REQUIRE(index.getLowestCommonAncestor(a, b) == expected);
+        CHECK(index.isAncestor(a, b) == (expected == a));
+        std::size_t k = random() % (path_a.size() + 1);
+        CHECK(index.getAncestor(a, k) ==
+              (k < path_a.size() ? path_a[path_a.size() - 1 - k] : index.end()));
+    }
+}